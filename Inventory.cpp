@@ -2,9 +2,47 @@
 
 #include <iostream>
 #include <vector>
+#include <array>
 #include <string>
 #include <iomanip>
 #include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <memory>
+#include <charconv>
+#include <string_view>
+#include <csignal>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -13,187 +51,7186 @@ struct Product {
     string sku;
     string name;
     int quantity;
+    int reserved;
 };
 
-// Global inventory vector
-vector<Product> inventory;
+// Parse all of text as a decimal integer in [low, high] in one pass, without
+// exceptions. Empty text, any stray character (signs included for unsigned
+// types) and out-of-range values, overflow included, return false and leave
+// value untouched.
+template <class T>
+bool parseNumber(string_view text, T& value, T low = numeric_limits<T>::min(), T high = numeric_limits<T>::max()) {
+    if (text.empty()) return false;
+    T parsed;
+    const char* end = text.data() + text.size();
+    auto result = from_chars(text.data(), end, parsed);
+    if (result.ec != errc() || result.ptr != end || parsed < low || parsed > high) return false;
+    value = parsed;
+    return true;
+}
+
+// On-hand and reserved units of one product packed into a single 64-bit
+// word, so reservations are lock-free compare-and-swap loops that can never
+// hand out more than is on hand
+class StockCounter {
+private:
+    atomic<uint64_t> word;
+    
+    static uint64_t pack(uint32_t onHand, uint32_t reserved) { return ((uint64_t)onHand << 32) | reserved; }
+    static uint32_t onHandOf(uint64_t w) { return (uint32_t)(w >> 32); }
+    static uint32_t reservedOf(uint64_t w) { return (uint32_t)w; }
+    
+public:
+    StockCounter(int onHand = 0) : word(pack(onHand, 0)) {}
+    StockCounter(const StockCounter& other) : word(other.word.load(memory_order_relaxed)) {}
+    StockCounter& operator=(const StockCounter& other) {
+        word.store(other.word.load(memory_order_relaxed), memory_order_relaxed);
+        return *this;
+    }
+    
+    int onHand() const { return onHandOf(word.load(memory_order_acquire)); }
+    int reserved() const { return reservedOf(word.load(memory_order_acquire)); }
+    
+    // Hold units for an order if that many are available (on hand minus reserved)
+    bool tryReserve(int units) {
+        uint64_t w = word.load(memory_order_acquire);
+        do {
+            if ((int64_t)onHandOf(w) - reservedOf(w) < units) return false;
+        } while (!word.compare_exchange_weak(w, pack(onHandOf(w), reservedOf(w) + units), memory_order_acq_rel));
+        return true;
+    }
+    
+    // Return reserved units to the available pool
+    bool release(int units) {
+        uint64_t w = word.load(memory_order_acquire);
+        do {
+            if (reservedOf(w) < (uint32_t)units) return false;
+        } while (!word.compare_exchange_weak(w, pack(onHandOf(w), reservedOf(w) - units), memory_order_acq_rel));
+        return true;
+    }
+    
+    // Turn reserved units into a sale: both on-hand and reserved drop
+    bool commit(int units) {
+        uint64_t w = word.load(memory_order_acquire);
+        do {
+            if (reservedOf(w) < (uint32_t)units) return false;
+        } while (!word.compare_exchange_weak(w, pack(onHandOf(w) - units, reservedOf(w) - units), memory_order_acq_rel));
+        return true;
+    }
+    
+    // Overwrite on-hand; refused if it would drop below what is reserved
+    bool set(int onHand) {
+        uint64_t w = word.load(memory_order_acquire);
+        do {
+            if ((uint32_t)onHand < reservedOf(w)) return false;
+        } while (!word.compare_exchange_weak(w, pack(onHand, reservedOf(w)), memory_order_acq_rel));
+        return true;
+    }
+    
+    // Add a signed delta to on-hand (journal replay of committed sales)
+    void adjust(int delta) {
+        uint64_t w = word.load(memory_order_acquire);
+        uint64_t next;
+        do {
+            int64_t onHand = max<int64_t>(0, (int64_t)onHandOf(w) + delta);
+            next = pack((uint32_t)onHand, reservedOf(w));
+        } while (!word.compare_exchange_weak(w, next, memory_order_acq_rel));
+    }
+};
+
+// Offset and length of a string interned in a ProductTable arena
+struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Fixed-width SKU key. SKUs of up to 16 bytes with no NUL byte are held
+// inline, zero padded, and compared as one 16-byte block (a single SSE2
+// compare where available); longer SKUs get the oversized marker and fall
+// back to comparing the full string.
+struct alignas(16) SkuKey {
+    char bytes[16];
+    
+    static uint64_t load64(const char* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    
+    static uint32_t load32(const char* p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    
+    // Build the zero-padded key with two overlapping word loads instead of a
+    // byte loop or a variable-length memcpy (little-endian layout assumed,
+    // as elsewhere in the file formats)
+    static SkuKey encode(string_view sku) {
+        const char* p = sku.data();
+        size_t n = sku.size();
+        uint64_t lo = 0, hi = 0;
+        if (n > 16) {
+            hi = 1ull << 56;    // a leading NUL with a nonzero tail never encodes a real SKU
+        } else if (n > 8) {
+            lo = load64(p);
+            hi = load64(p + n - 8) >> (8 * (16 - n));
+        } else if (n >= 4) {
+            lo = load32(p) | ((uint64_t)load32(p + n - 4) << (8 * (n - 4)));
+        } else {
+            for (size_t i = 0; i < n; i++) lo |= (uint64_t)(unsigned char)p[i] << (8 * i);
+        }
+        
+        SkuKey key;
+        memcpy(key.bytes, &lo, sizeof(lo));
+        memcpy(key.bytes + 8, &hi, sizeof(hi));
+        if (n <= 16 && key.hasNul(n)) {
+            memset(key.bytes, 0, sizeof(key.bytes));
+            key.bytes[15] = 1;
+        }
+        return key;
+    }
+    
+    // Whether any of the first n bytes is NUL
+    bool hasNul(size_t n) const {
+#if defined(__SSE2__)
+        __m128i v = _mm_load_si128((const __m128i*)bytes);
+        uint32_t zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        return (zeros & ((1u << n) - 1)) != 0;
+#else
+        return memchr(bytes, 0, n) != nullptr;
+#endif
+    }
+    
+    bool isInline() const { return bytes[0] != 0 || bytes[15] == 0; }
+    
+    bool operator==(const SkuKey& other) const {
+#if defined(__SSE2__)
+        __m128i a = _mm_load_si128((const __m128i*)bytes);
+        __m128i b = _mm_load_si128((const __m128i*)other.bytes);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+#else
+        uint64_t a[2], b[2];
+        memcpy(a, bytes, sizeof(a));
+        memcpy(b, other.bytes, sizeof(b));
+        return a[0] == b[0] && a[1] == b[1];
+#endif
+    }
+    
+    // Hash of the two 64-bit halves: two multiplies and a final mix instead
+    // of a loop over the bytes
+    uint32_t hash() const {
+        uint64_t w[2];
+        memcpy(w, bytes, sizeof(w));
+        uint64_t h = (w[0] * 0x9E3779B97F4A7C15ull) ^ ((w[1] + 0x632BE59BD9B4E019ull) * 0xC2B2AE3D27D4EB4Full);
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 32;
+        return (uint32_t)h;
+    }
+};
+
+// Scratch file holding the names of products paged out under a memory
+// budget. Space is handed out with an atomic tail and written with pwrite,
+// so shards page out in parallel; names are stored at 8-byte aligned slots
+// so a 32-bit slot number addresses 32 GiB. The file is truncated on open:
+// the snapshot and journal stay the durable copy of every name.
+class PageFile {
+private:
+    int fd;
+    atomic<uint64_t> tail;
+    mutable atomic<uint64_t> readErrors;
+    
+public:
+    static const uint64_t SLOT_BYTES = 8;
+    static const uint32_t NO_SLOT = 0xFFFFFFFF;
+    
+    PageFile() : fd(-1), tail(0), readErrors(0) {}
+    ~PageFile() { close(); }
+    
+    bool open(const string& path) {
+        close();
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        tail = 0;
+        return fd >= 0;
+    }
+    
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    
+    // Write text to a fresh slot; NO_SLOT if the file is full or the write failed
+    uint32_t append(string_view text) {
+        uint64_t span = max<uint64_t>(1, (text.size() + SLOT_BYTES - 1) / SLOT_BYTES) * SLOT_BYTES;
+        uint64_t at = tail.fetch_add(span);
+        if (at / SLOT_BYTES >= NO_SLOT) return NO_SLOT;
+        if (pwrite(fd, text.data(), text.size(), at) != (ssize_t)text.size()) return NO_SLOT;
+        return (uint32_t)(at / SLOT_BYTES);
+    }
+    
+    bool read(uint32_t slot, uint32_t length, string& out) const {
+        out.resize(length);
+        if (pread(fd, &out[0], length, (uint64_t)slot * SLOT_BYTES) == (ssize_t)length) return true;
+        readErrors++;
+        out.clear();
+        return false;
+    }
+    
+    uint64_t bytes() const { return tail.load(); }
+    uint64_t errors() const { return readErrors.load(); }
+};
+
+// CLOCK reference bit of one row. Readers set it under the shared lock, so
+// it is atomic; like StockCounter it copies by value for column moves.
+struct ReferenceBit {
+    atomic<uint8_t> set;
+    
+    ReferenceBit() : set(1) {}
+    ReferenceBit(const ReferenceBit& other) : set(other.set.load(memory_order_relaxed)) {}
+    ReferenceBit& operator=(const ReferenceBit& other) {
+        set.store(other.set.load(memory_order_relaxed), memory_order_relaxed);
+        return *this;
+    }
+};
+
+// Columnar product storage for one shard. SKU and name bytes are interned
+// back to back in a single arena and every column is a dense array indexed
+// by row, so scans and aggregates walk sequential memory instead of
+// following a heap pointer per string. Deleting a product only marks its row
+// as a tombstone; compact() squeezes tombstones and dead arena bytes out.
+// SKUs that fit a SkuKey live only in the key column, not in the arena.
+// With a memory budget, names of rows not touched since the CLOCK hand last
+// passed are paged out to a PageFile once the arena's live bytes exceed the
+// budget, and read back in when the row is looked up.
+class ProductTable {
+private:
+    vector<char> arena;
+    vector<SkuKey> keyColumn;
+    vector<StringRef> skuRefs;
+    vector<StringRef> nameRefs;    // offset PAGED_OUT while the name is only on disk
+    vector<StockCounter> stockColumn;
+    vector<uint8_t> deletedColumn;    // 1 for tombstoned rows
+    size_t tombstoneCount;
+    size_t deadBytes;    // arena bytes of tombstoned rows and paged-out names
+    size_t tombstoneBytes;    // the part of deadBytes held by tombstoned rows
+    size_t inlineBytes;    // SKU bytes of live rows held in the key column
+    
+    // Paging state; the columns stay empty unless paging is enabled
+    PageFile* pageFile;
+    size_t budgetBytes;
+    vector<uint32_t> pageColumn;    // page file slot of each row's name, or NO_SLOT if never written
+    vector<ReferenceBit> referenceColumn;
+    size_t clockHand;
+    size_t pagedRows;
+    size_t pagedBytes;    // name bytes of live rows held only on disk
+    uint64_t evictions;
+    mutable atomic<uint64_t> pageHits;
+    mutable atomic<uint64_t> pageMisses;
+    
+    static const uint32_t PAGED_OUT = 0xFFFFFFFF;
+    
+    StringRef intern(string_view text) {
+        StringRef ref = {(uint32_t)arena.size(), (uint32_t)text.size()};
+        arena.insert(arena.end(), text.begin(), text.end());
+        return ref;
+    }
+    
+    string_view view(StringRef ref) const { return string_view(arena.data() + ref.offset, ref.length); }
+    
+    static void bump(atomic<uint64_t>& counter) {
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    
+    // Rewrite the arena with only the strings still held in it, keeping row
+    // numbers, so paging churn does not grow it without bound. Tombstoned
+    // rows keep their strings: read views rebuild them until compact().
+    void repackArena() {
+        vector<char> packed;
+        packed.reserve(arena.size() - deadBytes + tombstoneBytes);
+        for (size_t i = 0; i < skuRefs.size(); i++) {
+            for (StringRef* ref : {&skuRefs[i], &nameRefs[i]}) {
+                if ((ref == &skuRefs[i] && keyColumn[i].isInline()) || ref->offset == PAGED_OUT) continue;
+                uint32_t offset = packed.size();
+                packed.insert(packed.end(), arena.begin() + ref->offset, arena.begin() + ref->offset + ref->length);
+                ref->offset = offset;
+            }
+        }
+        arena.swap(packed);
+        deadBytes = tombstoneBytes;
+    }
+    
+public:
+    ProductTable()
+        : tombstoneCount(0), deadBytes(0), tombstoneBytes(0), inlineBytes(0), pageFile(nullptr), budgetBytes(0), clockHand(0),
+          pagedRows(0), pagedBytes(0), evictions(0), pageHits(0), pageMisses(0) {}
+    
+    // Rows including tombstones; positions run from 0 to rowCount() - 1
+    size_t rowCount() const { return skuRefs.size(); }
+    size_t size() const { return skuRefs.size() - tombstoneCount; }
+    bool empty() const { return size() == 0; }
+    bool isLive(size_t i) const { return !deletedColumn[i]; }
+    size_t tombstones() const { return tombstoneCount; }
+    
+    // Views stay valid until the next push or compaction
+    string_view sku(size_t i) const {
+        return keyColumn[i].isInline() ? string_view(keyColumn[i].bytes, skuRefs[i].length) : view(skuRefs[i]);
+    }
+    const SkuKey& key(size_t i) const { return keyColumn[i]; }
+    StockCounter& stock(size_t i) { return stockColumn[i]; }
+    const StockCounter& stock(size_t i) const { return stockColumn[i]; }
+    
+    // Name of row i, read back from the page file if it is paged out; false
+    // if the page file could not return it
+    bool name(size_t i, string& out) const {
+        if (nameRefs[i].offset == PAGED_OUT) return pageFile->read(pageColumn[i], nameRefs[i].length, out);
+        out.assign(view(nameRefs[i]));
+        return true;
+    }
+    size_t nameLength(size_t i) const { return nameRefs[i].length; }
+    bool isResident(size_t i) const { return nameRefs[i].offset != PAGED_OUT; }
+    
+    // Mark row i recently used for the CLOCK sweep
+    void touch(size_t i) const {
+        if (referenceColumn.empty()) return;
+        atomic<uint8_t>& bit = const_cast<atomic<uint8_t>&>(referenceColumn[i].set);
+        if (!bit.load(memory_order_relaxed)) bit.store(1, memory_order_relaxed);
+    }
+    
+    bool toProduct(size_t i, Product& out) const {
+        touch(i);
+        out = Product{string(sku(i)), string(), stockColumn[i].onHand(), stockColumn[i].reserved()};
+        return name(i, out.name);
+    }
+    
+    // Page names out once the arena's live bytes pass budget; only valid while empty
+    void enablePaging(PageFile* file, size_t budget) {
+        pageFile = file;
+        budgetBytes = budget;
+    }
+    
+    bool pagingEnabled() const { return pageFile != nullptr; }
+    
+    // Count a point lookup as served from memory or from the page file
+    void countAccess(bool resident) const {
+        if (pageFile) bump(resident ? pageHits : pageMisses);
+    }
+    
+    // Bring row i's name back into the arena (caller holds the lock exclusively)
+    bool faultIn(size_t i) {
+        if (isResident(i)) return true;
+        string text;
+        if (!pageFile->read(pageColumn[i], nameRefs[i].length, text)) return false;
+        nameRefs[i] = intern(text);
+        referenceColumn[i].set.store(1, memory_order_relaxed);
+        pagedRows--;
+        pagedBytes -= text.size();
+        return true;
+    }
+    
+    // Sweep the CLOCK hand, paging out names whose reference bit is clear
+    // (and clearing the bits it passes) until the arena's live bytes fit the
+    // budget. A name is written to the page file once and keeps its slot, so
+    // evicting it again costs no I/O. Caller holds the lock exclusively.
+    size_t trimToBudget() {
+        if (!pageFile || liveStringBytes() <= budgetBytes) return 0;
+        size_t evicted = 0, rows = rowCount();
+        for (size_t scanned = 0; liveStringBytes() > budgetBytes && scanned < 2 * rows; scanned++) {
+            size_t i = clockHand;
+            clockHand = clockHand + 1 < rows ? clockHand + 1 : 0;
+            if (deletedColumn[i] || !isResident(i)) continue;
+            if (referenceColumn[i].set.load(memory_order_relaxed)) {
+                referenceColumn[i].set.store(0, memory_order_relaxed);
+                continue;
+            }
+            if (pageColumn[i] == PageFile::NO_SLOT) {
+                pageColumn[i] = pageFile->append(view(nameRefs[i]));
+                if (pageColumn[i] == PageFile::NO_SLOT) break;
+            }
+            deadBytes += nameRefs[i].length;
+            pagedBytes += nameRefs[i].length;
+            nameRefs[i].offset = PAGED_OUT;
+            pagedRows++;
+            evicted++;
+        }
+        evictions += evicted;
+        if (deadBytes - tombstoneBytes > max<size_t>(liveStringBytes(), 1 << 16)) repackArena();
+        return evicted;
+    }
+    
+    // Size the columns and arena up front for a bulk load
+    void reserve(size_t products, size_t stringBytes) {
+        keyColumn.reserve(products);
+        skuRefs.reserve(products);
+        nameRefs.reserve(products);
+        stockColumn.reserve(products);
+        deletedColumn.reserve(products);
+        if (pageFile) {
+            pageColumn.reserve(products);
+            referenceColumn.reserve(products);
+            stringBytes = min(stringBytes, budgetBytes);
+        }
+        arena.reserve(arena.size() + stringBytes);
+    }
+    
+    // Append a product and return its position
+    size_t push(string_view skuText, string_view nameText, int quantity) {
+        keyColumn.push_back(SkuKey::encode(skuText));
+        if (keyColumn.back().isInline()) {
+            skuRefs.push_back(StringRef{0, (uint32_t)skuText.size()});
+            inlineBytes += skuText.size();
+        } else {
+            skuRefs.push_back(intern(skuText));
+        }
+        nameRefs.push_back(intern(nameText));
+        stockColumn.emplace_back(quantity);
+        deletedColumn.push_back(0);
+        if (pageFile) {
+            pageColumn.push_back(uint32_t(PageFile::NO_SLOT));
+            referenceColumn.emplace_back();
+        }
+        return skuRefs.size() - 1;
+    }
+    
+    // Tombstone the product at row pos in O(1). Its stock is zeroed so
+    // column aggregates need no liveness check.
+    void markDeleted(size_t pos) {
+        deletedColumn[pos] = 1;
+        stockColumn[pos] = StockCounter(0);
+        tombstoneCount++;
+        size_t bytes = 0;
+        if (keyColumn[pos].isInline()) inlineBytes -= skuRefs[pos].length;
+        else bytes += skuRefs[pos].length;
+        if (isResident(pos)) {
+            bytes += nameRefs[pos].length;
+        } else {
+            pagedRows--;
+            pagedBytes -= nameRefs[pos].length;
+        }
+        deadBytes += bytes;
+        tombstoneBytes += bytes;
+    }
+    
+    // Position each row will have once tombstones are removed (EMPTY_ROW for tombstones)
+    static const uint32_t EMPTY_ROW = 0xFFFFFFFF;
+    
+    void positionMap(vector<uint32_t>& newPosition) const {
+        newPosition.resize(skuRefs.size());
+        uint32_t next = 0;
+        for (size_t i = 0; i < skuRefs.size(); i++) newPosition[i] = deletedColumn[i] ? EMPTY_ROW : next++;
+    }
+    
+    // Slide live rows down over the tombstones and rewrite the arena with only
+    // their strings, in one sweep. newPosition receives the old -> new row map.
+    void compact(vector<uint32_t>& newPosition) {
+        positionMap(newPosition);
+        vector<char> packed;
+        packed.reserve(arena.size() - deadBytes);
+        size_t live = 0;
+        for (size_t i = 0; i < skuRefs.size(); i++) {
+            if (deletedColumn[i]) continue;
+            for (StringRef* ref : {&skuRefs[i], &nameRefs[i]}) {
+                if ((ref == &skuRefs[i] && keyColumn[i].isInline()) || ref->offset == PAGED_OUT) continue;
+                uint32_t offset = packed.size();
+                packed.insert(packed.end(), arena.begin() + ref->offset, arena.begin() + ref->offset + ref->length);
+                ref->offset = offset;
+            }
+            keyColumn[live] = keyColumn[i];
+            skuRefs[live] = skuRefs[i];
+            nameRefs[live] = nameRefs[i];
+            stockColumn[live] = stockColumn[i];
+            if (pageFile) {
+                pageColumn[live] = pageColumn[i];
+                referenceColumn[live] = referenceColumn[i];
+            }
+            live++;
+        }
+        arena.swap(packed);
+        keyColumn.resize(live);
+        skuRefs.resize(live);
+        nameRefs.resize(live);
+        stockColumn.resize(live);
+        if (pageFile) {
+            pageColumn.resize(live);
+            referenceColumn.resize(live);
+        }
+        clockHand = 0;
+        deletedColumn.assign(live, 0);
+        tombstoneCount = 0;
+        deadBytes = 0;
+        tombstoneBytes = 0;
+    }
+    
+    // Units on hand and reserved, summed in one pass over the stock column
+    void stockTotals(long long& onHand, long long& reserved) const {
+        for (const StockCounter& c : stockColumn) {
+            onHand += c.onHand();
+            reserved += c.reserved();
+        }
+    }
+    
+    size_t liveStringBytes() const { return arena.size() - deadBytes; }
+    // Live SKU and name bytes held in memory
+    size_t residentTextBytes() const { return liveStringBytes() + inlineBytes; }
+    // Live SKU and name bytes wherever they are held, including the page file
+    size_t liveTextBytes() const { return residentTextBytes() + pagedBytes; }
+    size_t arenaBytes() const { return arena.size(); }
+    
+    // Bytes held by the columns and arena, including spare capacity
+    size_t memoryBytes() const {
+        return arena.capacity() + keyColumn.capacity() * sizeof(SkuKey) +
+               (skuRefs.capacity() + nameRefs.capacity()) * sizeof(StringRef) +
+               stockColumn.capacity() * sizeof(StockCounter) + deletedColumn.capacity() +
+               pageColumn.capacity() * sizeof(uint32_t) + referenceColumn.capacity() * sizeof(ReferenceBit);
+    }
+    
+    // Paging counters: names paged out and their bytes, lookups served from
+    // memory and from disk, and evictions so far
+    void pagingCounters(size_t& rows, size_t& bytes, uint64_t& hits, uint64_t& misses, uint64_t& evicted) const {
+        rows = pagedRows;
+        bytes = pagedBytes;
+        hits = pageHits.load(memory_order_relaxed);
+        misses = pageMisses.load(memory_order_relaxed);
+        evicted = evictions;
+    }
+};
+
+// Statistics reported by the SKU index
+struct IndexStats {
+    size_t entries;
+    size_t capacity;
+    double loadFactor;
+    double averageProbeLength;
+    size_t maxProbeLength;
+    size_t filterBytes;
+    uint64_t filterRejects;         // lookups answered "absent" by the Bloom filter alone
+    uint64_t filterFalsePositives;  // lookups the filter let through for absent SKUs
+};
+
+// Open-addressing hash index (linear probing) mapping SKU -> position in a product vector
+class SkuIndex {
+public:
+    // Slot layout is also the on-disk layout used by inventory snapshots
+    struct Slot {
+        uint32_t hash;
+        uint32_t position;
+    };
+    
+    static const uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+    
+private:
+    const ProductTable& products;
+    vector<Slot> slots;
+    size_t count;
+    size_t mask;
+    
+    // Blocked Bloom filter over the stored hashes, checked before probing.
+    // Each SKU sets FILTER_PROBES bits inside one 64-byte block, so a
+    // definite miss reads a single cache line of a filter about 9x smaller
+    // than the table (7 bits against each 64-bit slot; --bench-bloom prints
+    // both sizes). It is sized with the table (10 bits per key at the 0.7 load
+    // limit) and rebuilt from the slots' hashes on every rehash, compaction
+    // and snapshot load, which also clears the bits deleted SKUs leave behind.
+    static const int FILTER_PROBES = 6;
+    vector<uint64_t> filter;
+    size_t filterBlocks;
+    bool filterEnabled;
+    // Bumped by concurrent readers with plain relaxed stores, so a few
+    // increments may be lost; they only feed the false-positive rate
+    mutable atomic<uint64_t> filterRejects;
+    mutable atomic<uint64_t> filterFalsePositives;
+    
+    // 64 filter bits from the 32-bit SKU hash (splitmix64 finalizer): the top
+    // half picks the block, the low 54 bits give six 9-bit positions in it
+    static uint64_t filterBits(uint32_t hash) {
+        uint64_t x = hash + 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+    
+    size_t filterBlock(uint64_t bits) const { return (size_t)(((bits >> 32) * filterBlocks) >> 32) * 8; }
+    
+    void filterAdd(uint32_t hash) {
+        uint64_t bits = filterBits(hash);
+        uint64_t* block = &filter[filterBlock(bits)];
+        for (int p = 0; p < FILTER_PROBES; p++) {
+            unsigned bit = (bits >> (9 * p)) & 511;
+            block[bit >> 6] |= uint64_t(1) << (bit & 63);
+        }
+    }
+    
+    bool filterMayContain(uint32_t hash) const {
+        uint64_t bits = filterBits(hash);
+        const uint64_t* block = &filter[filterBlock(bits)];
+        for (int p = 0; p < FILTER_PROBES; p++) {
+            unsigned bit = (bits >> (9 * p)) & 511;
+            if (!(block[bit >> 6] & (uint64_t(1) << (bit & 63)))) return false;
+        }
+        return true;
+    }
+    
+    void rebuildFilter() {
+        filterBlocks = max<size_t>(1, (slots.size() * 7 + 511) / 512);
+        filter.assign(filterBlocks * 8, 0);
+        for (const Slot& s : slots) {
+            if (s.position != EMPTY_SLOT) filterAdd(s.hash);
+        }
+    }
+    
+    static void bump(atomic<uint64_t>& counter) {
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    
+    // Distance of the entry in slot i from its home slot
+    size_t probeDistance(size_t i) const {
+        return (i - (slots[i].hash & mask)) & mask;
+    }
+    
+    // Find the slot holding sku, or -1 if absent. Inline keys are matched
+    // with one 16-byte compare against the key column; oversized SKUs are
+    // compared as strings.
+    long long findSlot(const SkuKey& key, string_view sku, uint32_t hash) const {
+        bool inlineKey = key.isInline();
+        size_t i = hash & mask;
+        while (slots[i].position != EMPTY_SLOT) {
+            if (slots[i].hash == hash) {
+                uint32_t pos = slots[i].position;
+                if (inlineKey ? products.key(pos) == key : products.sku(pos) == sku) return (long long)i;
+            }
+            i = (i + 1) & mask;
+        }
+        return -1;
+    }
+    
+    void placeSlot(uint32_t hash, uint32_t position) {
+        size_t i = hash & mask;
+        while (slots[i].position != EMPTY_SLOT) {
+            i = (i + 1) & mask;
+        }
+        slots[i].hash = hash;
+        slots[i].position = position;
+    }
+    
+    void rehash(size_t capacity) {
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(capacity, Slot{0, EMPTY_SLOT});
+        mask = slots.size() - 1;
+        for (const Slot& s : old) {
+            if (s.position != EMPTY_SLOT) placeSlot(s.hash, s.position);
+        }
+        rebuildFilter();
+    }
+    
+public:
+    SkuIndex(const ProductTable& productStore)
+        : products(productStore), slots(16, Slot{0, EMPTY_SLOT}), count(0), mask(15), filterBlocks(0),
+          filterEnabled(true), filterRejects(0), filterFalsePositives(0) {
+        rebuildFilter();
+    }
+    
+    // SkuKey hash for SKUs that fit a fixed key; otherwise 32-bit FNV-1a
+    // with a final avalanche step, since linear probing only looks at the low bits
+    static uint32_t hashSku(string_view sku) { return hashKey(SkuKey::encode(sku), sku); }
+    
+    static uint32_t hashKey(const SkuKey& key, string_view sku) {
+        if (key.isInline()) return key.hash();
+        uint32_t h = 2166136261u;
+        for (unsigned char c : sku) {
+            h ^= c;
+            h *= 16777619u;
+        }
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        return h;
+    }
+    
+    // Returns the product position for sku, or -1 if not indexed
+    long long find(string_view sku) const {
+        SkuKey key = SkuKey::encode(sku);
+        uint32_t hash = hashKey(key, sku);
+        if (filterEnabled && !filterMayContain(hash)) {
+            bump(filterRejects);
+            return -1;
+        }
+        long long slot = findSlot(key, sku, hash);
+        if (slot < 0) {
+            if (filterEnabled) bump(filterFalsePositives);
+            return -1;
+        }
+        return (long long)slots[slot].position;
+    }
+    
+    // Turn the Bloom filter check off (for comparisons) or back on
+    void setFilterEnabled(bool enabled) {
+        if (enabled && !filterEnabled) rebuildFilter();
+        filterEnabled = enabled;
+    }
+    
+    // Index sku at the given position (caller guarantees it is not present)
+    void insert(const string& sku, uint32_t position) {
+        insertHashed(hashSku(sku), position);
+    }
+    
+    // Insert with a precomputed hash (used by bulk import)
+    void insertHashed(uint32_t hash, uint32_t position) {
+        // Keep the load factor at or below 0.7
+        if ((count + 1) * 10 > slots.size() * 7) rehash(slots.size() * 2);
+        placeSlot(hash, position);
+        if (filterEnabled) filterAdd(hash);
+        count++;
+    }
+    
+    // Lookup with a precomputed hash (used by bulk import)
+    long long findHashed(string_view sku, uint32_t hash) const {
+        if (filterEnabled && !filterMayContain(hash)) return -1;
+        long long slot = findSlot(SkuKey::encode(sku), sku, hash);
+        return slot < 0 ? -1 : (long long)slots[slot].position;
+    }
+    
+    // Size the table for n entries up front so a bulk load rehashes at most once
+    void reserve(size_t n) {
+        size_t capacity = slots.size();
+        while (n * 10 > capacity * 7) capacity *= 2;
+        if (capacity != slots.size()) rehash(capacity);
+    }
+    
+    // Rewrite every entry's position through an old -> new row map after the
+    // product table has been compacted; one pass, no rehashing
+    void remap(const vector<uint32_t>& newPosition) {
+        for (Slot& slot : slots) {
+            if (slot.position != EMPTY_SLOT) slot.position = newPosition[slot.position];
+        }
+        rebuildFilter();
+    }
+    
+    // Remove sku using backward-shift deletion (no tombstones left behind)
+    bool erase(string_view sku) {
+        SkuKey key = SkuKey::encode(sku);
+        long long found = findSlot(key, sku, hashKey(key, sku));
+        if (found < 0) return false;
+        
+        size_t hole = (size_t)found;
+        size_t next = (hole + 1) & mask;
+        while (slots[next].position != EMPTY_SLOT) {
+            // Shift back any entry whose probe sequence passes through the hole
+            if (probeDistance(next) >= ((next - hole) & mask)) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+        slots[hole].position = EMPTY_SLOT;
+        count--;
+        return true;
+    }
+    
+    const vector<Slot>& rawSlots() const { return slots; }
+    
+    // Replace the table with a previously saved one (slotCount must be a power of two)
+    void adopt(const Slot* data, size_t slotCount, size_t entries) {
+        slots.assign(data, data + slotCount);
+        mask = slotCount - 1;
+        count = entries;
+        rebuildFilter();
+    }
+    
+    IndexStats stats() const {
+        IndexStats s = {count, slots.size(), (double)count / slots.size(), 0.0, 0, filter.size() * sizeof(uint64_t),
+                        filterRejects.load(), filterFalsePositives.load()};
+        size_t totalProbe = 0;
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].position == EMPTY_SLOT) continue;
+            size_t probes = probeDistance(i) + 1;
+            totalProbe += probes;
+            s.maxProbeLength = max(s.maxProbeLength, probes);
+        }
+        if (count > 0) s.averageProbeLength = (double)totalProbe / count;
+        return s;
+    }
+};
+
+// Maximum number of products a single name search returns
+const size_t MAX_NAME_RESULTS = 20;
+
+// Upper bound on candidates inspected for a multi-word query
+const size_t MAX_WORD_CANDIDATES = MAX_NAME_RESULTS * 50;
+
+// SKUs matched by a name search, grouped by how they matched
+struct NameMatches {
+    vector<string> exact;
+    vector<string> prefix;
+    vector<string> words;
+    bool truncated;
+};
+
+// A name within edit distance of a fuzzy query
+struct FuzzyName {
+    string name;
+    int distance;
+    int sharedTrigrams;
+    vector<string> skus;    // filled in by NameIndex
+};
+
+// Trigram (3-gram) inverted index over lower-cased names for typo-tolerant
+// search. Candidates must share enough trigrams with the query to possibly
+// be within the edit-distance limit before any edit distance is computed.
+class TrigramIndex {
+private:
+    unordered_map<uint32_t, vector<uint32_t>> postings;    // trigram -> name ids, ascending
+    deque<string> terms;                                   // name by id (deque keeps views stable)
+    vector<uint8_t> removedTerm;
+    unordered_map<string_view, uint32_t> ids;
+    size_t removedCount;
+    
+    // Distinct trigrams of a name padded with two leading and one trailing
+    // marker, so word boundaries and one- or two-character names count too
+    static vector<uint32_t> trigramsOf(string_view term) {
+        string padded = "\x01\x01" + string(term) + "\x02";
+        vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= padded.size(); i++) {
+            grams.push_back((uint32_t)(unsigned char)padded[i] << 16 | (uint32_t)(unsigned char)padded[i + 1] << 8 |
+                            (unsigned char)padded[i + 2]);
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+    
+    // Rebuild postings without removed names once they outnumber live ones
+    void rebuild() {
+        deque<string> live;
+        for (size_t id = 0; id < terms.size(); id++) {
+            if (!removedTerm[id]) live.push_back(move(terms[id]));
+        }
+        postings.clear();
+        ids.clear();
+        terms.clear();
+        removedTerm.clear();
+        removedCount = 0;
+        for (string& term : live) add(term);
+    }
+    
+public:
+    TrigramIndex() : removedCount(0) {}
+    
+    // Levenshtein distance between a and b, or limit + 1 as soon as it must exceed limit
+    static int boundedEditDistance(string_view a, string_view b, int limit) {
+        if ((int)a.size() - (int)b.size() > limit || (int)b.size() - (int)a.size() > limit) return limit + 1;
+        thread_local vector<int> previous, current;
+        previous.resize(b.size() + 1);
+        current.resize(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); j++) previous[j] = (int)j;
+        for (size_t i = 1; i <= a.size(); i++) {
+            current[0] = (int)i;
+            int rowMin = current[0];
+            for (size_t j = 1; j <= b.size(); j++) {
+                int substitute = previous[j - 1] + (a[i - 1] != b[j - 1]);
+                current[j] = min(substitute, min(previous[j], current[j - 1]) + 1);
+                rowMin = min(rowMin, current[j]);
+            }
+            if (rowMin > limit) return limit + 1;
+            previous.swap(current);
+        }
+        return min(previous[b.size()], limit + 1);
+    }
+    
+    // Index a lower-cased name (no effect if already present)
+    void add(const string& term) {
+        if (ids.count(term)) return;
+        uint32_t id = terms.size();
+        terms.push_back(term);
+        removedTerm.push_back(0);
+        ids.emplace(terms.back(), id);
+        for (uint32_t gram : trigramsOf(term)) postings[gram].push_back(id);
+    }
+    
+    // Drop a name; its postings are skipped until the next rebuild
+    void remove(const string& term) {
+        auto it = ids.find(term);
+        if (it == ids.end()) return;
+        removedTerm[it->second] = 1;
+        ids.erase(it);
+        if (++removedCount > 1024 && removedCount * 2 > terms.size()) rebuild();
+    }
+    
+    // Names within maxDistance edits of query, closest (then most shared
+    // trigrams) first, at most limit of them. The query trigrams are taken in
+    // order of rarity: enough of the rarest lists are scanned that every match
+    // must appear in one, further lists are scanned while they are much shorter
+    // than the candidate set (cheaper than probing them per candidate), and the rest are probed by binary search.
+    vector<FuzzyName> search(const string& query, int maxDistance, size_t limit) const {
+        vector<FuzzyName> found;
+        vector<pair<const vector<uint32_t>*, uint32_t>> lists;
+        vector<uint32_t> grams = trigramsOf(query);
+        static const vector<uint32_t> none;
+        for (uint32_t gram : grams) {
+            auto it = postings.find(gram);
+            lists.push_back({it == postings.end() ? &none : &it->second, gram});
+        }
+        sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.first->size() < b.first->size(); });
+        
+        // Each edit destroys at most three trigrams
+        int need = max(1, (int)grams.size() - 3 * maxDistance);
+        size_t mustScan = grams.size() - need + 1;
+        
+        thread_local vector<uint16_t> shared;
+        thread_local vector<uint32_t> touched;
+        if (shared.size() < terms.size()) shared.resize(terms.size(), 0);
+        touched.clear();
+        size_t scanned = 0;
+        while (scanned < lists.size() && (scanned < mustScan || lists[scanned].first->size() * 4 <= touched.size())) {
+            for (uint32_t id : *lists[scanned].first) {
+                if (shared[id]++ == 0) touched.push_back(id);
+            }
+            scanned++;
+        }
+        
+        // A candidate seen fewer times than this cannot reach need even if it
+        // is in every list left unscanned
+        int scannedNeed = need - (int)(lists.size() - scanned);
+        for (uint32_t id : touched) {
+            int count = shared[id];
+            shared[id] = 0;
+            if (count < scannedNeed || removedTerm[id]) continue;
+            const string& term = terms[id];
+            if ((int)term.size() - (int)query.size() > maxDistance || (int)query.size() - (int)term.size() > maxDistance) continue;
+            for (size_t l = scanned; l < lists.size() && count + (int)(lists.size() - l) >= need; l++) {
+                if (binary_search(lists[l].first->begin(), lists[l].first->end(), id)) count++;
+            }
+            if (count < need) continue;
+            int distance = boundedEditDistance(query, term, maxDistance);
+            if (distance <= maxDistance) found.push_back(FuzzyName{term, distance, count, {}});
+        }
+        
+        sort(found.begin(), found.end(), [](const FuzzyName& a, const FuzzyName& b) {
+            if (a.distance != b.distance) return a.distance < b.distance;
+            if (a.sharedTrigrams != b.sharedTrigrams) return a.sharedTrigrams > b.sharedTrigrams;
+            return a.name < b.name;
+        });
+        if (found.size() > limit) found.resize(limit);
+        return found;
+    }
+    
+    size_t distinctTrigrams() const { return postings.size(); }
+};
+
+// Sorted dictionary of lower-cased names and name words -> SKUs, plus a
+// trigram index over the distinct names for fuzzy search
+class NameIndex {
+private:
+    map<string, set<string>> names;
+    map<string, set<string>> tokens;
+    TrigramIndex trigrams;
+    
+    static void removeFrom(map<string, set<string>>& dict, const string& key, const string& sku) {
+        auto it = dict.find(key);
+        if (it == dict.end()) return;
+        it->second.erase(sku);
+        if (it->second.empty()) dict.erase(it);
+    }
+    
+    static bool startsWith(const string& s, const string& prefix) {
+        return s.compare(0, prefix.size(), prefix) == 0;
+    }
+    
+    // Append SKUs not already collected, stopping at the result limit
+    static bool collect(const set<string>& skus, vector<string>& out, set<string>& seen, size_t& total) {
+        for (const string& sku : skus) {
+            if (total >= MAX_NAME_RESULTS) return false;
+            if (seen.insert(sku).second) {
+                out.push_back(sku);
+                total++;
+            }
+        }
+        return true;
+    }
+    
+public:
+    static string toLower(const string& s) {
+        string out(s);
+        for (char& c : out) c = (char)tolower((unsigned char)c);
+        return out;
+    }
+    
+    // Split a name into lower-cased words on anything that is not a letter or digit
+    static vector<string> tokenize(const string& name) {
+        vector<string> words;
+        string word;
+        for (char c : name) {
+            if (isalnum((unsigned char)c)) {
+                word += (char)tolower((unsigned char)c);
+            } else if (!word.empty()) {
+                words.push_back(word);
+                word.clear();
+            }
+        }
+        if (!word.empty()) words.push_back(word);
+        return words;
+    }
+    
+    void insert(const string& sku, const string& name) {
+        string key = toLower(name);
+        set<string>& skus = names[key];
+        if (skus.empty()) trigrams.add(key);
+        skus.insert(sku);
+        for (const string& word : tokenize(name)) tokens[word].insert(sku);
+    }
+    
+    void erase(const string& sku, const string& name) {
+        string key = toLower(name);
+        removeFrom(names, key, sku);
+        if (!names.count(key)) trigrams.remove(key);
+        for (const string& word : tokenize(name)) removeFrom(tokens, word, sku);
+    }
+    
+    // Edit distance allowed for a fuzzy query of the given length
+    static int fuzzyLimit(size_t queryLength) {
+        return queryLength <= 4 ? 1 : queryLength <= 8 ? 2 : 3;
+    }
+    
+    // Names within maxDistance edits of the query with their SKUs, closest
+    // first; at most MAX_NAME_RESULTS SKUs in total
+    vector<FuzzyName> fuzzySearch(const string& query, int maxDistance) const {
+        string key = toLower(query);
+        vector<FuzzyName> found = trigrams.search(key, maxDistance, MAX_NAME_RESULTS);
+        size_t total = 0;
+        for (FuzzyName& match : found) {
+            for (const string& sku : names.find(match.name)->second) {
+                if (total++ >= MAX_NAME_RESULTS) break;
+                match.skus.push_back(sku);
+            }
+        }
+        return found;
+    }
+    
+    // Exact name matches, then names starting with the query, then names whose
+    // words start with every query word. At most MAX_NAME_RESULTS SKUs in total.
+    NameMatches search(const string& query) const {
+        NameMatches result;
+        result.truncated = false;
+        set<string> seen;
+        size_t total = 0;
+        string key = toLower(query);
+        
+        auto exact = names.find(key);
+        if (exact != names.end() && !collect(exact->second, result.exact, seen, total)) {
+            result.truncated = true;
+            return result;
+        }
+        
+        for (auto it = names.lower_bound(key); it != names.end() && startsWith(it->first, key); ++it) {
+            if (!collect(it->second, result.prefix, seen, total)) {
+                result.truncated = true;
+                return result;
+            }
+        }
+        
+        vector<string> words = tokenize(query);
+        if (words.empty()) return result;
+        
+        // Candidates come from the prefix range of the most selective word
+        // (estimated by its first matching token); the remaining words are
+        // checked against the candidate's indexed words
+        size_t driver = 0, bestEstimate = SIZE_MAX;
+        for (size_t w = 0; w < words.size(); w++) {
+            auto first = tokens.lower_bound(words[w]);
+            if (first == tokens.end() || !startsWith(first->first, words[w])) return result;
+            if (first->second.size() < bestEstimate) {
+                bestEstimate = first->second.size();
+                driver = w;
+            }
+        }
+        
+        size_t inspected = 0;
+        for (auto it = tokens.lower_bound(words[driver]); it != tokens.end() && startsWith(it->first, words[driver]); ++it) {
+            for (const string& sku : it->second) {
+                if (++inspected > MAX_WORD_CANDIDATES || total >= MAX_NAME_RESULTS) {
+                    result.truncated = true;
+                    return result;
+                }
+                if (seen.count(sku)) continue;
+                
+                bool allMatch = true;
+                for (size_t w = 0; w < words.size() && allMatch; w++) {
+                    if (w == driver) continue;
+                    allMatch = false;
+                    for (auto t = tokens.lower_bound(words[w]); t != tokens.end() && startsWith(t->first, words[w]); ++t) {
+                        if (t->second.count(sku)) {
+                            allMatch = true;
+                            break;
+                        }
+                        if (++inspected > MAX_WORD_CANDIDATES) {
+                            result.truncated = true;
+                            return result;
+                        }
+                    }
+                }
+                if (allMatch) {
+                    seen.insert(sku);
+                    result.words.push_back(sku);
+                    total++;
+                }
+            }
+        }
+        return result;
+    }
+    
+    size_t distinctNames() const { return names.size(); }
+    size_t distinctWords() const { return tokens.size(); }
+    size_t distinctTrigrams() const { return trigrams.distinctTrigrams(); }
+};
+
+// Journal record types
+// (JOURNAL_ADJUST carries a signed delta, e.g. a committed reservation;
+// JOURNAL_TRANSACTION carries every line of a transaction packed into the
+// sku field, with the line count as its quantity)
+enum JournalOp : uint8_t { JOURNAL_INSERT = 1, JOURNAL_UPDATE = 2, JOURNAL_DELETE = 3, JOURNAL_ADJUST = 4,
+                           JOURNAL_TRANSACTION = 5 };
+
+// One decoded journal record
+struct JournalRecord {
+    uint64_t sequence;
+    uint8_t op;
+    int32_t quantity;
+    string sku;
+    string name;
+};
+
+// One line of a multi-line transaction: a signed change to a SKU's on-hand stock
+struct TransactionLine {
+    string sku;
+    int32_t delta;
+};
+
+// Pack transaction lines as [u32 skuLength][i32 delta][sku] each
+void encodeTransactionLines(string& out, const vector<TransactionLine>& lines) {
+    for (const TransactionLine& line : lines) {
+        uint32_t skuLength = line.sku.size();
+        out.append((const char*)&skuLength, 4);
+        out.append((const char*)&line.delta, 4);
+        out.append(line.sku);
+    }
+}
+
+// Unpack lines written by encodeTransactionLines; false if the data is malformed
+bool decodeTransactionLines(const string& packed, vector<TransactionLine>& lines) {
+    lines.clear();
+    size_t at = 0;
+    while (at < packed.size()) {
+        uint32_t skuLength;
+        TransactionLine line;
+        if (packed.size() - at < 8) return false;
+        memcpy(&skuLength, packed.data() + at, 4);
+        memcpy(&line.delta, packed.data() + at + 4, 4);
+        at += 8;
+        if (packed.size() - at < skuLength) return false;
+        line.sku.assign(packed, at, skuLength);
+        at += skuLength;
+        lines.push_back(move(line));
+    }
+    return true;
+}
+
+// Journal framing (little-endian, no padding):
+//   [u32 bodyLength][u32 crc32(body)]
+//   body = [u64 sequence][u8 op][i32 quantity][u32 skuLength][u32 nameLength][sku][name]
+const size_t JOURNAL_FRAME_HEADER = 8;
+const size_t JOURNAL_BODY_FIXED = 21;
+
+// CRC-32 (IEEE polynomial) used to detect torn or corrupt journal records
+uint32_t crc32(const char* data, size_t length) {
+    // Built once; the initialization of a function-local static is thread-safe
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> entries;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+        return entries;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Append one framed record to out
+void encodeJournalRecord(string& out, uint64_t sequence, uint8_t op, const string& sku, const string& name, int32_t quantity) {
+    uint32_t skuLength = sku.size(), nameLength = name.size();
+    uint32_t bodyLength = JOURNAL_BODY_FIXED + skuLength + nameLength;
+    size_t start = out.size();
+    out.resize(start + JOURNAL_FRAME_HEADER + bodyLength);
+    
+    char* body = &out[start + JOURNAL_FRAME_HEADER];
+    memcpy(body, &sequence, 8);
+    body[8] = (char)op;
+    memcpy(body + 9, &quantity, 4);
+    memcpy(body + 13, &skuLength, 4);
+    memcpy(body + 17, &nameLength, 4);
+    memcpy(body + JOURNAL_BODY_FIXED, sku.data(), skuLength);
+    memcpy(body + JOURNAL_BODY_FIXED + skuLength, name.data(), nameLength);
+    
+    uint32_t crc = crc32(body, bodyLength);
+    memcpy(&out[start], &bodyLength, 4);
+    memcpy(&out[start + 4], &crc, 4);
+}
+
+// Decode the record at data; returns the bytes consumed, or 0 if the record
+// is incomplete or fails its checksum
+size_t decodeJournalRecord(const char* data, size_t available, JournalRecord& record) {
+    if (available < JOURNAL_FRAME_HEADER) return 0;
+    uint32_t bodyLength, crc;
+    memcpy(&bodyLength, data, 4);
+    memcpy(&crc, data + 4, 4);
+    if (bodyLength < JOURNAL_BODY_FIXED || bodyLength > available - JOURNAL_FRAME_HEADER) return 0;
+    
+    const char* body = data + JOURNAL_FRAME_HEADER;
+    if (crc32(body, bodyLength) != crc) return 0;
+    
+    uint32_t skuLength, nameLength;
+    memcpy(&record.sequence, body, 8);
+    record.op = (uint8_t)body[8];
+    memcpy(&record.quantity, body + 9, 4);
+    memcpy(&skuLength, body + 13, 4);
+    memcpy(&nameLength, body + 17, 4);
+    if ((uint64_t)JOURNAL_BODY_FIXED + skuLength + nameLength != bodyLength) return 0;
+    record.sku.assign(body + JOURNAL_BODY_FIXED, skuLength);
+    record.name.assign(body + JOURNAL_BODY_FIXED + skuLength, nameLength);
+    return JOURNAL_FRAME_HEADER + bodyLength;
+}
+
+// Counters reported by the journal
+struct JournalStats {
+    uint64_t records;
+    uint64_t groupCommits;
+    uint64_t bytesWritten;
+    uint64_t lastSequence;
+    uint64_t durableSequence;
+};
+
+// Steady clock in nanoseconds. On Linux this is CLOCK_MONOTONIC, which all
+// processes on a host share, so a leader's timestamps mean the same to its followers.
+int64_t steadyNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Outcome of reading the replication log
+enum LogRead { LOG_OK, LOG_TIMEOUT, LOG_RESYNC, LOG_CLOSED };
+
+// Durable journal records kept in memory for shipping to followers: one
+// chunk per group commit, oldest chunks dropped past capacityBytes. A
+// follower that needs a record no longer held (or claims one the leader
+// never wrote) must resynchronize from a snapshot.
+class ReplicationLog {
+private:
+    struct Chunk {
+        uint64_t first;
+        uint64_t last;
+        int64_t durableNanos;  // steady clock, when the group commit finished
+        string frames;
+    };
+    
+    mutable mutex lock;
+    condition_variable ready;
+    deque<Chunk> chunks;
+    size_t bytes;
+    size_t capacity;
+    uint64_t last;
+    bool closed;
+    
+public:
+    ReplicationLog(size_t capacityBytes = 64 << 20) : bytes(0), capacity(capacityBytes), last(0), closed(false) {}
+    
+    // Start empty after startSequence, the last record already on disk
+    void reset(uint64_t startSequence) {
+        lock_guard<mutex> guard(lock);
+        chunks.clear();
+        bytes = 0;
+        last = startSequence;
+        closed = false;
+    }
+    
+    // Add the frames of records first..lastSequence once they are durable
+    void append(string frames, uint64_t first, uint64_t lastSequence) {
+        lock_guard<mutex> guard(lock);
+        // A gap means records were written while nothing was shipping
+        if (first != last + 1) {
+            chunks.clear();
+            bytes = 0;
+        }
+        bytes += frames.size();
+        chunks.push_back(Chunk{first, lastSequence, steadyNanos(), move(frames)});
+        while (bytes > capacity && chunks.size() > 1) {
+            bytes -= chunks.front().frames.size();
+            chunks.pop_front();
+        }
+        last = lastSequence;
+        ready.notify_all();
+    }
+    
+    // Copy whole chunks holding the records after `after` into out, about
+    // maxBytes at most, waiting up to timeoutMs for one to arrive. through is
+    // the last record copied and durableNanos when it became durable; out may
+    // start with records the caller already has.
+    LogRead read(uint64_t after, string& out, uint64_t& through, int64_t& durableNanos, size_t maxBytes, int timeoutMs) {
+        unique_lock<mutex> guard(lock);
+        if (after == last && !closed) {
+            ready.wait_for(guard, chrono::milliseconds(timeoutMs), [&] { return after != last || closed; });
+        }
+        if (closed) return LOG_CLOSED;
+        if (after == last) return LOG_TIMEOUT;
+        if (after > last || chunks.empty() || chunks.front().first > after + 1) return LOG_RESYNC;
+        
+        auto chunk = partition_point(chunks.begin(), chunks.end(), [after](const Chunk& c) { return c.last <= after; });
+        out.clear();
+        for (; chunk != chunks.end() && (out.empty() || out.size() + chunk->frames.size() <= maxBytes); ++chunk) {
+            out += chunk->frames;
+            through = chunk->last;
+            durableNanos = chunk->durableNanos;
+        }
+        return LOG_OK;
+    }
+    
+    uint64_t lastSequence() const {
+        lock_guard<mutex> guard(lock);
+        return last;
+    }
+    
+    size_t retainedBytes() const {
+        lock_guard<mutex> guard(lock);
+        return bytes;
+    }
+    
+    // Wake every reader; reads return LOG_CLOSED from now on
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        ready.notify_all();
+    }
+};
+
+// Append-only write-ahead journal with group commit. Mutations are appended
+// to an in-memory buffer and a background thread writes and fdatasyncs the
+// whole buffer at once, so concurrent commits share one sync. The sync window
+// holds each group open a little longer to collect more records.
+class Journal {
+private:
+    int fd;
+    string path;
+    chrono::microseconds syncWindow;
+    bool asyncCommit;
+    
+    mutex lock;
+    condition_variable pendingReady;
+    condition_variable durableReady;
+    string pending;
+    uint64_t pendingRecords;
+    uint64_t nextSequence;
+    uint64_t durableSequence;
+    bool stopping;
+    bool failed;
+    thread flusher;
+    JournalStats counters;
+    ReplicationLog* shipping;    // guarded by lock
+    
+    void flushLoop() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            pendingReady.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) break;
+            
+            // Keep the group open for the sync window so more commits can join
+            if (syncWindow.count() > 0 && !stopping) {
+                pendingReady.wait_for(guard, syncWindow, [this] { return stopping; });
+            }
+            
+            string batch;
+            batch.swap(pending);
+            uint64_t batchLast = nextSequence;
+            uint64_t batchRecords = pendingRecords;
+            pendingRecords = 0;
+            
+            guard.unlock();
+            bool ok = true;
+            size_t written = 0;
+            while (ok && written < batch.size()) {
+                ssize_t n = write(fd, batch.data() + written, batch.size() - written);
+                if (n < 0) ok = false;
+                else written += n;
+            }
+            ok = ok && fdatasync(fd) == 0;
+            guard.lock();
+            
+            if (!ok) failed = true;
+            durableSequence = max(durableSequence, batchLast);
+            counters.records += batchRecords;
+            counters.groupCommits++;
+            counters.bytesWritten += batch.size();
+            // Only durable records are shipped, so a follower is never ahead of
+            // the disk; under the lock, as shipping changes with attach and restart
+            if (ok && shipping) shipping->append(move(batch), batchLast - batchRecords + 1, batchLast);
+            durableReady.notify_all();
+        }
+    }
+    
+public:
+    Journal() : fd(-1), syncWindow(0), asyncCommit(false), pendingRecords(0),
+                nextSequence(0), durableSequence(0), stopping(false), failed(false),
+                counters{0, 0, 0, 0, 0}, shipping(nullptr) {}
+    
+    ~Journal() { close(); }
+    
+    // Open (or create) the journal for appending; sequences continue after lastSequence
+    bool open(const string& journalFile, uint64_t lastSequence, int syncWindowMicros, bool async) {
+        path = journalFile;
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0) return false;
+        syncWindow = chrono::microseconds(syncWindowMicros);
+        asyncCommit = async;
+        nextSequence = durableSequence = lastSequence;
+        stopping = failed = false;
+        flusher = thread(&Journal::flushLoop, this);
+        return true;
+    }
+    
+    bool isOpen() const { return fd >= 0; }
+    
+    // Ship every record made durable from now on to target (set before
+    // mutations start)
+    void attachReplicationLog(ReplicationLog* target) {
+        lock_guard<mutex> guard(lock);
+        shipping = target;
+        if (shipping) shipping->reset(durableSequence);
+    }
+    
+    // Queue a record and return its sequence number
+    uint64_t append(uint8_t op, const string& sku, const string& name, int32_t quantity) {
+        lock_guard<mutex> guard(lock);
+        uint64_t sequence = ++nextSequence;
+        encodeJournalRecord(pending, sequence, op, sku, name, quantity);
+        pendingRecords++;
+        pendingReady.notify_one();
+        return sequence;
+    }
+    
+    // Queue frames received from a replication leader, keeping the leader's
+    // sequence numbers; lastSequence is the last record in them
+    void appendReplicated(string_view frames, uint64_t records, uint64_t lastSequence) {
+        lock_guard<mutex> guard(lock);
+        pending.append(frames.data(), frames.size());
+        pendingRecords += records;
+        nextSequence = lastSequence;
+        pendingReady.notify_one();
+    }
+    
+    // Continue numbering after sequence once everything queued is durable,
+    // e.g. when a replica installs a snapshot its leader took at that sequence
+    void restartAt(uint64_t sequence) {
+        unique_lock<mutex> guard(lock);
+        durableReady.wait(guard, [this] { return durableSequence >= nextSequence || stopping; });
+        nextSequence = durableSequence = sequence;
+        if (shipping) shipping->reset(sequence);
+    }
+    
+    // Block until the record with this sequence is on disk; false on I/O error
+    bool waitDurable(uint64_t sequence) {
+        unique_lock<mutex> guard(lock);
+        durableReady.wait(guard, [&] { return durableSequence >= sequence || stopping; });
+        return !failed;
+    }
+    
+    // Wait for an appended record the way the commit mode asks: until it is
+    // durable, or not at all with async commit
+    bool commit(uint64_t sequence) {
+        if (fd < 0 || sequence == 0) return true;
+        return asyncCommit || waitDurable(sequence);
+    }
+    
+    uint64_t lastSequence() {
+        lock_guard<mutex> guard(lock);
+        return nextSequence;
+    }
+    
+    // Drop the records covered by a snapshot taken at coveredSequence. Records
+    // appended after the snapshot are copied into a fresh file that replaces
+    // the journal, so concurrent writers never lose a change.
+    bool checkpoint(uint64_t coveredSequence) {
+        if (fd < 0) return true;
+        unique_lock<mutex> guard(lock);
+        durableReady.wait(guard, [this] { return durableSequence >= nextSequence; });
+        if (nextSequence <= coveredSequence) return ftruncate(fd, 0) == 0 && fdatasync(fd) == 0;
+        
+        string contents, tail;
+        char chunk[1 << 16];
+        ssize_t n;
+        off_t offset = 0;
+        while ((n = pread(fd, chunk, sizeof(chunk), offset)) > 0) {
+            contents.append(chunk, n);
+            offset += n;
+        }
+        JournalRecord record;
+        size_t pos = 0;
+        while (size_t used = decodeJournalRecord(contents.data() + pos, contents.size() - pos, record)) {
+            if (record.sequence > coveredSequence) tail.append(contents, pos, used);
+            pos += used;
+        }
+        
+        string tempPath = path + ".tmp";
+        int tempFd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (tempFd < 0) return false;
+        bool ok = write(tempFd, tail.data(), tail.size()) == (ssize_t)tail.size() && fdatasync(tempFd) == 0;
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+            ::close(tempFd);
+            unlink(tempPath.c_str());
+            return false;
+        }
+        ::close(fd);
+        fd = tempFd;
+        return true;
+    }
+    
+    JournalStats stats() {
+        lock_guard<mutex> guard(lock);
+        JournalStats s = counters;
+        s.lastSequence = nextSequence;
+        s.durableSequence = durableSequence;
+        return s;
+    }
+    
+    // Flush anything still pending and stop the writer thread
+    void close() {
+        if (fd < 0) return;
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            pendingReady.notify_all();
+        }
+        flusher.join();
+        ::close(fd);
+        fd = -1;
+    }
+};
+
+// Ordered secondary index on on-hand quantity: (quantity, row) pairs in a
+// balanced tree, so threshold, range and lowest-N queries cost O(log n) plus
+// the rows they return
+class QuantityIndex {
+private:
+    set<pair<int, uint32_t>> entries;
+    vector<int> indexedQuantity;    // per row, the quantity it is filed under (-1 if none)
+    
+public:
+    // File row under quantity, moving it if it was filed under another one
+    void update(uint32_t row, int quantity) {
+        if (row >= indexedQuantity.size()) indexedQuantity.resize(row + 1, -1);
+        int& current = indexedQuantity[row];
+        if (current == quantity) return;
+        if (current >= 0) entries.erase({current, row});
+        entries.insert({quantity, row});
+        current = quantity;
+    }
+    
+    void remove(uint32_t row) {
+        if (row >= indexedQuantity.size() || indexedQuantity[row] < 0) return;
+        entries.erase({indexedQuantity[row], row});
+        indexedQuantity[row] = -1;
+    }
+    
+    void clear() {
+        entries.clear();
+        indexedQuantity.clear();
+    }
+    
+    // Renumber rows after the product table was compacted. Compaction keeps
+    // row order, so the entries stay sorted and are re-inserted at the end.
+    void remap(const vector<uint32_t>& newPosition) {
+        set<pair<int, uint32_t>> renumbered;
+        vector<int> quantities;
+        for (const auto& entry : entries) {
+            uint32_t row = newPosition[entry.second];
+            renumbered.emplace_hint(renumbered.end(), entry.first, row);
+            if (row >= quantities.size()) quantities.resize(row + 1, -1);
+            quantities[row] = entry.first;
+        }
+        entries.swap(renumbered);
+        indexedQuantity.swap(quantities);
+    }
+    
+    // Visit rows with low <= quantity <= high in ascending quantity order, at most limit of them
+    template <class Visitor>
+    void scan(int low, int high, size_t limit, Visitor visit) const {
+        for (auto it = entries.lower_bound({low, 0}); it != entries.end() && it->first <= high && limit > 0; ++it, limit--) {
+            visit(it->second);
+        }
+    }
+    
+    // Visit the limit rows with the highest quantities, highest first
+    template <class Visitor>
+    void scanDescending(size_t limit, Visitor visit) const {
+        for (auto it = entries.rbegin(); it != entries.rend() && limit > 0; ++it, limit--) visit(it->second);
+    }
+    
+    size_t size() const { return entries.size(); }
+};
+
+// Result of applying a mutation to the in-memory store
+enum OpStatus { OP_OK, OP_NOT_FOUND, OP_DUPLICATE, OP_INSUFFICIENT };
+
+// Store operations that are counted and timed
+enum MetricOp {
+    METRIC_INSERT, METRIC_FIND, METRIC_NAME_SEARCH, METRIC_FUZZY_SEARCH, METRIC_UPDATE,
+    METRIC_DELETE, METRIC_RESERVE, METRIC_COMMIT, METRIC_RELEASE, METRIC_TRANSACTION, METRIC_COUNT
+};
+const char* const METRIC_NAMES[METRIC_COUNT] = {"insert", "find", "search_name", "fuzzy_search", "update",
+                                                "delete", "reserve", "commit", "release", "transaction"};
+
+// Percentiles of one histogram, in microseconds
+struct LatencySummary {
+    uint64_t count;
+    double mean, p50, p90, p99, p999, max;
+};
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below
+// 64 ns get a bucket each; above that every power of two is split into 32
+// buckets, so any recorded value is within about 3% of its bucket's upper
+// bound. It has a single writer: counters are bumped with relaxed loads and
+// stores rather than locked read-modify-writes, which would act as fences
+// and stall the cache misses of the operation being timed.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 5;
+    static const size_t SUB_COUNT = size_t(1) << SUB_BITS;
+    static const size_t BUCKETS = 2 * SUB_COUNT + (63 - SUB_BITS) * SUB_COUNT;
+    
+private:
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> sum;
+    atomic<uint64_t> largest;
+    
+    static void bump(atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+    
+public:
+    LatencyHistogram() : sum(0), largest(0) {
+        for (auto& c : counts) c.store(0, memory_order_relaxed);
+    }
+    
+    static size_t bucketOf(uint64_t nanos) {
+        if (nanos < 2 * SUB_COUNT) return (size_t)nanos;
+        int shift = 63 - __builtin_clzll(nanos) - SUB_BITS;
+        return 2 * SUB_COUNT + (shift - 1) * SUB_COUNT + (size_t)((nanos >> shift) - SUB_COUNT);
+    }
+    
+    // Largest value that lands in bucket
+    static uint64_t bucketLimit(size_t bucket) {
+        if (bucket < 2 * SUB_COUNT) return bucket;
+        size_t k = bucket - 2 * SUB_COUNT;
+        int shift = (int)(k / SUB_COUNT) + 1;
+        return ((uint64_t)(k % SUB_COUNT + SUB_COUNT + 1) << shift) - 1;
+    }
+    
+    // Called only by the thread that owns this histogram
+    void record(uint64_t nanos) {
+        bump(counts[bucketOf(nanos)], 1);
+        bump(sum, nanos);
+        if (nanos > largest.load(memory_order_relaxed)) largest.store(nanos, memory_order_relaxed);
+    }
+    
+    // Add this histogram to a merged copy (any thread)
+    void mergeInto(vector<uint64_t>& buckets, uint64_t& total, uint64_t& maxNanos) const {
+        for (size_t i = 0; i < BUCKETS; i++) buckets[i] += counts[i].load(memory_order_relaxed);
+        total += sum.load(memory_order_relaxed);
+        maxNanos = max(maxNanos, largest.load(memory_order_relaxed));
+    }
+    
+    static LatencySummary summarize(const vector<uint64_t>& buckets, uint64_t total, uint64_t maxNanos) {
+        uint64_t count = 0;
+        for (uint64_t c : buckets) count += c;
+        LatencySummary s = {count, 0, 0, 0, 0, 0, maxNanos / 1000.0};
+        if (count == 0) return s;
+        s.mean = total / 1000.0 / count;
+        
+        double* targets[] = {&s.p50, &s.p90, &s.p99, &s.p999};
+        const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        uint64_t seen = 0;
+        size_t next = 0;
+        for (size_t i = 0; i < BUCKETS && next < 4; i++) {
+            seen += buckets[i];
+            while (next < 4 && seen >= (uint64_t)ceil(quantiles[next] * count)) {
+                *targets[next++] = min(bucketLimit(i), maxNanos) / 1000.0;
+            }
+        }
+        return s;
+    }
+};
+
+// Call and failure counters and latency histograms for each store
+// operation. Every thread records into its own block, registered on first
+// use, and readers merge the blocks, so recording stays free of shared cache
+// lines. Every call is counted but only one in sampleInterval is timed:
+// reading the clock costs more than a cached lookup, mostly because it stops
+// the lookup's cache misses from overlapping with the next one.
+class OperationMetrics {
+private:
+    struct ThreadBlock {
+        LatencyHistogram histograms[METRIC_COUNT];
+        atomic<uint64_t> calls[METRIC_COUNT];
+        atomic<uint64_t> failures[METRIC_COUNT];
+        uint32_t untilSample;
+        
+        ThreadBlock() : untilSample(0) {
+            for (auto& c : calls) c.store(0, memory_order_relaxed);
+            for (auto& f : failures) f.store(0, memory_order_relaxed);
+        }
+    };
+    
+    atomic<uint32_t> sampleInterval;
+    mutable mutex registryLock;
+    vector<unique_ptr<ThreadBlock>> blocks;
+    map<thread::id, ThreadBlock*> owners;
+    
+    ThreadBlock& local() {
+        thread_local const OperationMetrics* cachedFor = nullptr;
+        thread_local ThreadBlock* cached = nullptr;
+        if (cachedFor != this) {
+            lock_guard<mutex> guard(registryLock);
+            ThreadBlock*& block = owners[this_thread::get_id()];
+            if (!block) {
+                blocks.emplace_back(new ThreadBlock());
+                block = blocks.back().get();
+            }
+            cachedFor = this;
+            cached = block;
+        }
+        return *cached;
+    }
+    
+    static void bump(atomic<uint64_t>& counter) {
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    
+    // Merged histogram, call count and failure count of one operation
+    LatencySummary merged(int op, uint64_t& calls, uint64_t& failed, vector<uint64_t>* buckets = nullptr) const {
+        vector<uint64_t> counts(LatencyHistogram::BUCKETS);
+        uint64_t total = 0, maxNanos = 0;
+        calls = failed = 0;
+        lock_guard<mutex> guard(registryLock);
+        for (const auto& block : blocks) {
+            block->histograms[op].mergeInto(counts, total, maxNanos);
+            calls += block->calls[op].load(memory_order_relaxed);
+            failed += block->failures[op].load(memory_order_relaxed);
+        }
+        if (buckets) *buckets = counts;
+        return LatencyHistogram::summarize(counts, total, maxNanos);
+    }
+    
+public:
+    OperationMetrics(uint32_t interval = 16) : sampleInterval(max<uint32_t>(1, interval)) {}
+    
+    // Time one call in interval (1 times every call)
+    void setSampleInterval(uint32_t interval) { sampleInterval = max<uint32_t>(1, interval); }
+    uint32_t sampleEvery() const { return sampleInterval.load(); }
+    
+    // Whether the calling thread's next operation should be timed
+    bool sampleNext() {
+        ThreadBlock& block = local();
+        if (block.untilSample > 0) {
+            block.untilSample--;
+            return false;
+        }
+        block.untilSample = sampleInterval.load(memory_order_relaxed) - 1;
+        return true;
+    }
+    
+    // Count a call, and add its latency when it was sampled
+    void record(MetricOp op, bool timed, uint64_t nanos, bool ok) {
+        ThreadBlock& block = local();
+        bump(block.calls[op]);
+        if (timed) block.histograms[op].record(nanos);
+        if (!ok) bump(block.failures[op]);
+    }
+    
+    // One line per operation that has been called
+    void writeText(ostream& out) const {
+        out << fixed << setprecision(2);
+        out << setw(14) << left << "Operation" << setw(11) << right << "Count" << setw(9) << "Failed"
+            << setw(10) << "Timed" << setw(10) << "Mean us" << setw(10) << "p50" << setw(10) << "p90"
+            << setw(10) << "p99" << setw(10) << "p99.9" << setw(11) << "Max" << endl;
+        out << string(105, '-') << endl;
+        for (int op = 0; op < METRIC_COUNT; op++) {
+            uint64_t calls, failed;
+            LatencySummary s = merged(op, calls, failed);
+            if (calls == 0) continue;
+            out << setw(14) << left << METRIC_NAMES[op] << setw(11) << right << calls << setw(9) << failed
+                << setw(10) << s.count << setw(10) << s.mean << setw(10) << s.p50 << setw(10) << s.p90 << setw(10) << s.p99
+                << setw(10) << s.p999 << setw(11) << s.max << endl;
+        }
+        out << left;
+        out.unsetf(ios::fixed);
+    }
+    
+    // A single-line JSON object; with buckets, each operation also lists its
+    // non-empty buckets as [upper bound ns, count] pairs so dumps can be merged
+    void writeJson(ostream& out, bool withBuckets) const {
+        out << fixed << setprecision(3) << "{\"unit\":\"us\",\"sample_every\":" << sampleEvery() << ",\"operations\":{";
+        for (int op = 0; op < METRIC_COUNT; op++) {
+            uint64_t calls, failed;
+            vector<uint64_t> buckets;
+            LatencySummary s = merged(op, calls, failed, &buckets);
+            out << (op ? "," : "") << '"' << METRIC_NAMES[op] << "\":{\"count\":" << calls << ",\"failed\":" << failed
+                << ",\"timed\":" << s.count << ",\"mean\":" << s.mean << ",\"p50\":" << s.p50 << ",\"p90\":" << s.p90 << ",\"p99\":" << s.p99
+                << ",\"p999\":" << s.p999 << ",\"max\":" << s.max;
+            if (withBuckets) {
+                out << ",\"buckets\":[";
+                bool first = true;
+                for (size_t i = 0; i < buckets.size(); i++) {
+                    if (buckets[i] == 0) continue;
+                    out << (first ? "" : ",") << '[' << LatencyHistogram::bucketLimit(i) << ',' << buckets[i] << ']';
+                    first = false;
+                }
+                out << ']';
+            }
+            out << '}';
+        }
+        out << "}}";
+        out.unsetf(ios::fixed);
+    }
+};
+
+// Counts one store operation and, when it is sampled, times it; finish()
+// records it with its outcome. Does nothing when no metrics are attached.
+class OperationTimer {
+private:
+    OperationMetrics* metrics;
+    MetricOp op;
+    bool timed;
+    chrono::steady_clock::time_point start;
+    
+    void stop(bool ok) {
+        if (!metrics) return;
+        uint64_t nanos = timed ? chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() : 0;
+        metrics->record(op, timed, nanos, ok);
+    }
+    
+public:
+    OperationTimer(OperationMetrics* target, MetricOp operation)
+        : metrics(target), op(operation), timed(target && target->sampleNext()) {
+        if (timed) start = chrono::steady_clock::now();
+    }
+    
+    OpStatus finish(OpStatus status) {
+        stop(status == OP_OK);
+        return status;
+    }
+    
+    bool finish(bool found) {
+        stop(found);
+        return found;
+    }
+};
+
+// Number of shards used unless --shards says otherwise
+const size_t DEFAULT_SHARDS = 16;
+
+// A shard is compacted once at least this many rows, and this fraction of
+// its rows, are tombstones
+const size_t COMPACT_MIN_TOMBSTONES = 1024;
+const double COMPACT_TOMBSTONE_RATIO = 0.25;
+
+// Totals for compaction passes since startup
+struct CompactionStats {
+    size_t passes;
+    size_t rowsReclaimed;
+    size_t bytesReclaimed;
+    double totalMs;
+    double maxPauseMs;    // longest time one shard was locked for compaction
+};
+
+// What an undo entry restores for a point-in-time reader
+enum UndoKind : uint8_t { UNDO_INSERT, UNDO_VALUE, UNDO_DELETE };
+
+// State of a row before one change, kept while a snapshot reader may need it
+struct UndoEntry {
+    uint64_t version;    // version of the change
+    uint32_t row;
+    uint8_t kind;        // UNDO_INSERT: row did not exist before; otherwise previous holds the old on-hand
+    int32_t previous;
+};
+
+// One shard of the inventory: its products, their indexes and the
+// reader-writer lock that guards all of them. Stock counters change under the
+// shared lock; commitLock orders committed sales with their journal records.
+struct InventoryShard {
+    mutable shared_mutex lock;
+    mutable mutex commitLock;
+    ProductTable products;
+    SkuIndex skuIndex;
+    NameIndex nameIndex;
+    bool nameIndexStale;    // set after bulk loads; rebuilt on first name search
+    mutable mutex quantityLock;
+    QuantityIndex quantityIndex;
+    bool quantityIndexStale;    // set after bulk loads; rebuilt on first quantity query
+    deque<UndoEntry> undoLog;   // changes newer than the oldest open read view, in version order
+    
+    // Running totals over live rows. Changes to one shard's stock are already
+    // serialized (exclusive lock, or commitLock for sales), so writers use
+    // plain relaxed stores; the atomics only let readers skip the lock.
+    atomic<size_t> liveProducts;
+    atomic<long long> unitsOnHand;
+    atomic<size_t> outOfStock;
+    
+    InventoryShard()
+        : skuIndex(products), nameIndexStale(false), quantityIndexStale(false), liveProducts(0), unitsOnHand(0), outOfStock(0) {}
+    
+    // Account for a product's on-hand stock going from before to after, where
+    // -1 means the product does not exist (before an insert, after a delete)
+    void trackStock(int before, int after) {
+        size_t live = liveProducts.load(memory_order_relaxed) + (after >= 0) - (before >= 0);
+        size_t empty = outOfStock.load(memory_order_relaxed) + (after == 0) - (before == 0);
+        long long units = unitsOnHand.load(memory_order_relaxed) + max(after, 0) - max(before, 0);
+        liveProducts.store(live, memory_order_relaxed);
+        outOfStock.store(empty, memory_order_relaxed);
+        unitsOnHand.store(units, memory_order_relaxed);
+    }
+    
+    // Recompute the totals from the table after a bulk load (caller holds the lock exclusively)
+    void recountStock() {
+        size_t live = 0, empty = 0;
+        long long units = 0;
+        for (size_t i = 0; i < products.rowCount(); i++) {
+            if (!products.isLive(i)) continue;
+            int onHand = products.stock(i).onHand();
+            live++;
+            empty += onHand == 0;
+            units += onHand;
+        }
+        liveProducts.store(live, memory_order_relaxed);
+        outOfStock.store(empty, memory_order_relaxed);
+        unitsOnHand.store(units, memory_order_relaxed);
+    }
+    
+    // Refile a row after its on-hand stock changed. The value is re-read under
+    // quantityLock, so concurrent commits on the same row leave the index at
+    // the latest value whichever of them gets here last.
+    void reindexQuantity(size_t row) {
+        lock_guard<mutex> guard(quantityLock);
+        if (!quantityIndexStale) quantityIndex.update(row, products.stock(row).onHand());
+    }
+    
+    // Rebuild the quantity index (caller holds the lock exclusively)
+    void rebuildQuantityIndex() {
+        quantityIndex.clear();
+        for (size_t i = 0; i < products.rowCount(); i++) {
+            if (products.isLive(i)) quantityIndex.update(i, products.stock(i).onHand());
+        }
+        quantityIndexStale = false;
+    }
+    
+    // Rebuild the name index (caller holds the lock exclusively). A name the
+    // page file cannot return is left out rather than indexed as empty.
+    void rebuildNameIndex() {
+        nameIndex = NameIndex();
+        string name;
+        for (size_t i = 0; i < products.rowCount(); i++) {
+            if (products.isLive(i) && products.name(i, name)) nameIndex.insert(string(products.sku(i)), name);
+        }
+        nameIndexStale = false;
+    }
+    
+    bool needsCompaction() const {
+        return products.tombstones() >= COMPACT_MIN_TOMBSTONES &&
+               products.tombstones() >= products.rowCount() * COMPACT_TOMBSTONE_RATIO;
+    }
+    
+    // Drop tombstoned rows and dead arena bytes and repoint the SKU and
+    // quantity indexes in one sweep (caller holds the lock exclusively). The name index is keyed
+    // by SKU, not row, so it is unaffected.
+    void compact(size_t& rowsReclaimed, size_t& bytesReclaimed) {
+        rowsReclaimed = products.tombstones();
+        bytesReclaimed = products.arenaBytes() - products.liveStringBytes();
+        vector<uint32_t> newPosition;
+        products.compact(newPosition);
+        skuIndex.remap(newPosition);
+        if (!quantityIndexStale) quantityIndex.remap(newPosition);
+        undoLog.clear();
+    }
+};
+
+// A product found by fuzzy name search and its name's edit distance from the query
+struct FuzzyProduct {
+    Product product;
+    int distance;
+};
+
+// Catalog-wide totals kept up to date by every change
+struct StockAggregates {
+    size_t products;
+    long long unitsOnHand;
+    size_t outOfStock;
+};
+
+// Memory-budget paging totals across all shards
+struct PagingStats {
+    bool enabled;
+    size_t budgetBytes;
+    size_t residentBytes;    // arena bytes in memory (names, and SKUs too long for a SkuKey)
+    size_t pagedNames;
+    size_t pagedBytes;
+    uint64_t hits;           // lookups whose name was in memory
+    uint64_t misses;         // lookups that read the name back from disk
+    uint64_t evictions;
+    uint64_t pageFileBytes;
+    uint64_t readErrors;
+};
+
+// Products found by a name search across all shards
+struct NameSearchResult {
+    vector<Product> exact;
+    vector<Product> prefix;
+    vector<Product> words;
+    bool truncated;
+};
+
+// Kinds of change feed events
+enum ChangeKind : uint8_t { CHANGE_INSERT = 1, CHANGE_UPDATE = 2, CHANGE_DELETE = 3 };
+
+// One inventory mutation as delivered to change feed subscribers. Quantities
+// are absolute on-hand values, so replaying an event twice is harmless.
+struct ChangeEvent {
+    uint64_t sequence;
+    uint8_t kind;
+    string sku;
+    int32_t quantity;  // on hand after the change (0 for deletes)
+    int32_t previous;  // on hand before the change (0 for inserts)
+};
+
+enum FeedStatus { FEED_OK, FEED_TIMEOUT, FEED_OVERRUN, FEED_CLOSED };
+
+// A subscriber's position in the change feed
+struct FeedCursor {
+    uint64_t next;      // sequence of the next event to deliver
+    uint64_t missed;    // events overwritten before this subscriber read them
+    uint64_t overruns;  // times it fell a full ring behind
+};
+
+struct FeedStats {
+    uint64_t published;
+    size_t retained;
+    size_t capacity;
+    uint64_t overruns;
+    uint64_t missed;
+    size_t subscribersWaiting;
+};
+
+// In-memory change data capture feed: a fixed ring of the latest events,
+// numbered from 1. Writers only ever overwrite the oldest slot, so a slow
+// subscriber can never hold them up; instead it finds its cursor overrun,
+// is told how many events it missed, and resynchronizes from a read view.
+class ChangeFeed {
+private:
+    mutable mutex lock;
+    condition_variable ready;
+    vector<ChangeEvent> ring;
+    uint64_t mask;
+    uint64_t published;
+    uint64_t overruns;
+    uint64_t missed;
+    size_t waiting;
+    bool closed;
+    
+    uint64_t oldest() const { return published < ring.size() ? 1 : published - ring.size() + 1; }
+    
+public:
+    ChangeFeed(size_t capacity = 65536) : mask(0), published(0), overruns(0), missed(0), waiting(0), closed(false) {
+        size_t slots = 1;
+        while (slots < capacity) slots <<= 1;
+        ring.resize(slots);
+        mask = slots - 1;
+    }
+    
+    // Append an event; slot strings keep their capacity, so this does not
+    // allocate once the ring has wrapped
+    uint64_t publish(uint8_t kind, string_view sku, int quantity, int previous) {
+        lock_guard<mutex> guard(lock);
+        uint64_t sequence = ++published;
+        ChangeEvent& slot = ring[sequence & mask];
+        slot.sequence = sequence;
+        slot.kind = kind;
+        slot.sku.assign(sku.data(), sku.size());
+        slot.quantity = quantity;
+        slot.previous = previous;
+        if (waiting > 0) ready.notify_all();
+        return sequence;
+    }
+    
+    // Cursor at the next event to be published, or at the oldest retained one
+    FeedCursor subscribe(bool fromOldest = false) const {
+        lock_guard<mutex> guard(lock);
+        return FeedCursor{fromOldest ? oldest() : published + 1, 0, 0};
+    }
+    
+    // Deliver up to maxBatch events after cursor into out, waiting up to
+    // timeoutMs for the first one. FEED_OVERRUN means events were lost: the
+    // cursor has been moved to the oldest retained event and the caller
+    // should resubscribe and rebuild its state from a read view.
+    FeedStatus poll(FeedCursor& cursor, vector<ChangeEvent>& out, size_t maxBatch, int timeoutMs) {
+        unique_lock<mutex> guard(lock);
+        if (cursor.next > published && !closed && timeoutMs > 0) {
+            waiting++;
+            ready.wait_for(guard, chrono::milliseconds(timeoutMs), [&] { return cursor.next <= published || closed; });
+            waiting--;
+        }
+        uint64_t first = oldest();
+        if (cursor.next < first) {
+            cursor.missed += first - cursor.next;
+            cursor.overruns++;
+            missed += first - cursor.next;
+            overruns++;
+            cursor.next = first;
+            out.clear();
+            return FEED_OVERRUN;
+        }
+        
+        size_t count = (size_t)min<uint64_t>(maxBatch, published + 1 - cursor.next);
+        out.clear();
+        for (size_t i = 0; i < count; i++) out.push_back(ring[(cursor.next + i) & mask]);
+        cursor.next += count;
+        if (count > 0) return FEED_OK;
+        return closed ? FEED_CLOSED : FEED_TIMEOUT;
+    }
+    
+    // Events published but not yet delivered to cursor
+    uint64_t lag(const FeedCursor& cursor) const {
+        lock_guard<mutex> guard(lock);
+        return published + 1 - min(cursor.next, published + 1);
+    }
+    
+    // Wake every waiting subscriber; polls return FEED_CLOSED once drained
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        ready.notify_all();
+    }
+    
+    FeedStats stats() const {
+        lock_guard<mutex> guard(lock);
+        return FeedStats{published, (size_t)(published + 1 - oldest()), ring.size(), overruns, missed, waiting};
+    }
+};
+
+// Inventory split into a power-of-two number of shards by SKU hash. Each
+// shard has its own reader-writer lock, so lookups share a shard and writers
+// only block the shard they touch. Journal records are appended while the
+// shard lock is held, so journal order matches the order changes were applied.
+class ShardedInventory {
+private:
+    vector<unique_ptr<InventoryShard>> shards;
+    uint32_t shardBits;
+    Journal* journal;
+    ChangeFeed* feed;
+    OperationMetrics* metrics;
+    PageFile* pageFile;
+    size_t pagingBudget;
+    mutable mutex compactionLock;
+    CompactionStats compaction;
+    
+    // Multi-version reads: every change takes the next version from
+    // versionClock. While read views are open, writers keep an undo entry per
+    // change so a view can rebuild any row as of its version without ever
+    // blocking writers for longer than one shard copy.
+    atomic<uint64_t> versionClock;
+    atomic<size_t> openViews;
+    atomic<uint64_t> oldestViewVersion;
+    mutex viewsLock;
+    multiset<uint64_t> viewVersions;
+    
+    // Version a change to row and keep its undo entry if a view may need it.
+    // Caller holds the shard lock exclusively, or shared plus commitLock.
+    // Changes that must appear together pass one shared version.
+    void recordChange(InventoryShard& s, uint32_t row, uint8_t kind, int previous, uint64_t version = 0) {
+        if (version == 0) version = versionClock.fetch_add(1) + 1;
+        if (openViews.load() == 0) {
+            if (!s.undoLog.empty()) s.undoLog.clear();
+            return;
+        }
+        uint64_t oldest = oldestViewVersion.load();
+        while (!s.undoLog.empty() && s.undoLog.front().version <= oldest) s.undoLog.pop_front();
+        s.undoLog.push_back(UndoEntry{version, row, kind, previous});
+    }
+    
+    // find() without the timing, for lookups made on behalf of other operations.
+    // A name that was paged out is faulted back in under the exclusive lock;
+    // false as well if it cannot be read back.
+    bool lookup(string_view sku, Product& out) const {
+        InventoryShard& s = *shards[shardFor(sku)];
+        {
+            shared_lock<shared_mutex> guard(s.lock);
+            long long pos = s.skuIndex.find(sku);
+            if (pos < 0) return false;
+            bool resident = s.products.isResident(pos);
+            s.products.countAccess(resident);
+            if (resident) return s.products.toProduct(pos, out);
+        }
+        unique_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return false;
+        if (s.products.faultIn(pos)) s.products.trimToBudget();
+        return s.products.toProduct(pos, out);
+    }
+    
+    uint64_t log(uint8_t op, const string& sku, const string& name, int32_t quantity) {
+        return journal ? journal->append(op, sku, name, quantity) : 0;
+    }
+    
+    // Publish to the change feed while the shard lock is still held, so
+    // events for one SKU reach subscribers in the order they were applied
+    void publish(uint8_t kind, const string& sku, int quantity, int previous) {
+        if (feed) feed->publish(kind, sku, quantity, previous);
+    }
+    
+    // Compact one shard (caller holds its lock exclusively), adding to pass and the running totals
+    void compactShard(InventoryShard& s, CompactionStats& pass) {
+        auto start = chrono::high_resolution_clock::now();
+        size_t rows, bytes;
+        s.compact(rows, bytes);
+        double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+        
+        lock_guard<mutex> guard(compactionLock);
+        for (CompactionStats* stats : {&pass, &compaction}) {
+            stats->passes++;
+            stats->rowsReclaimed += rows;
+            stats->bytesReclaimed += bytes;
+            stats->totalMs += ms;
+            stats->maxPauseMs = max(stats->maxPauseMs, ms);
+        }
+    }
+    
+public:
+    ShardedInventory(size_t shardCount = DEFAULT_SHARDS)
+        : shardBits(0), journal(nullptr), feed(nullptr), metrics(nullptr), pageFile(nullptr), pagingBudget(0),
+          versionClock(0), openViews(0), oldestViewVersion(UINT64_MAX) {
+        compaction = CompactionStats{0, 0, 0, 0.0, 0.0};
+        configure(shardCount);
+    }
+    
+    // Set the shard count (rounded up to a power of two); only valid while empty
+    void configure(size_t shardCount) {
+        shardBits = 0;
+        while ((size_t(1) << shardBits) < shardCount) shardBits++;
+        shards.clear();
+        for (size_t i = 0; i < (size_t(1) << shardBits); i++) shards.emplace_back(new InventoryShard());
+        if (pageFile) enablePaging(pageFile, pagingBudget);
+    }
+    
+    // Journal that mutations are logged to (none while replaying)
+    void attachJournal(Journal* target) { journal = target; }
+    
+    // Change feed that mutations are published to (none while replaying)
+    void attachFeed(ChangeFeed* target) { feed = target; }
+    
+    // Counters and latency histograms that operations are recorded in
+    void attachMetrics(OperationMetrics* target) { metrics = target; }
+    
+    // Keep product names within budgetBytes of memory, split evenly across
+    // the shards, paging cold ones out to file; only valid while empty.
+    // SKUs, stock and the indexes always stay resident.
+    void enablePaging(PageFile* file, size_t budgetBytes) {
+        pageFile = file;
+        pagingBudget = budgetBytes;
+        for (auto& s : shards) s->products.enablePaging(file, budgetBytes / shards.size());
+    }
+    
+    size_t shardCount() const { return shards.size(); }
+    InventoryShard& shard(size_t i) { return *shards[i]; }
+    const InventoryShard& shard(size_t i) const { return *shards[i]; }
+    
+    // Shard for a SKU hash: the SKU index uses the low bits, so take the top
+    // bits of a multiplicative remix
+    size_t shardOf(uint32_t hash) const {
+        return shardBits == 0 ? 0 : (uint32_t)(hash * 0x9E3779B1u) >> (32 - shardBits);
+    }
+    
+    size_t shardFor(string_view sku) const { return shardOf(SkuIndex::hashSku(sku)); }
+    
+    OpStatus insert(const string& sku, const string& name, int quantity, uint64_t* sequence = nullptr) {
+        OperationTimer timer(metrics, METRIC_INSERT);
+        InventoryShard& s = *shards[shardFor(sku)];
+        unique_lock<shared_mutex> guard(s.lock);
+        if (s.skuIndex.find(sku) >= 0) return timer.finish(OP_DUPLICATE);
+        size_t row = s.products.push(sku, name, quantity);
+        s.skuIndex.insert(sku, row);
+        s.reindexQuantity(row);
+        s.trackStock(-1, quantity);
+        recordChange(s, row, UNDO_INSERT, 0);
+        if (!s.nameIndexStale) s.nameIndex.insert(sku, name);
+        s.products.trimToBudget();
+        publish(CHANGE_INSERT, sku, quantity, 0);
+        uint64_t seq = log(JOURNAL_INSERT, sku, name, quantity);
+        if (sequence) *sequence = seq;
+        return timer.finish(OP_OK);
+    }
+    
+    // Copy out the product for sku; false if there is none
+    bool find(string_view sku, Product& out) const {
+        OperationTimer timer(metrics, METRIC_FIND);
+        return timer.finish(lookup(sku, out));
+    }
+    
+    bool contains(string_view sku) const {
+        const InventoryShard& s = *shards[shardFor(sku)];
+        shared_lock<shared_mutex> guard(s.lock);
+        return s.skuIndex.find(sku) >= 0;
+    }
+    
+    // Overwrite the quantity of an existing product. Takes the shard
+    // exclusively so the absolute value is ordered against committed sales.
+    OpStatus update(const string& sku, int quantity, uint64_t* sequence = nullptr) {
+        OperationTimer timer(metrics, METRIC_UPDATE);
+        InventoryShard& s = *shards[shardFor(sku)];
+        unique_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return timer.finish(OP_NOT_FOUND);
+        int previous = s.products.stock(pos).onHand();
+        if (!s.products.stock(pos).set(quantity)) return timer.finish(OP_INSUFFICIENT);
+        s.reindexQuantity(pos);
+        s.trackStock(previous, quantity);
+        recordChange(s, pos, UNDO_VALUE, previous);
+        publish(CHANGE_UPDATE, sku, quantity, previous);
+        uint64_t seq = log(JOURNAL_UPDATE, sku, "", quantity);
+        if (sequence) *sequence = seq;
+        return timer.finish(OP_OK);
+    }
+    
+    // Reserve units of a product without taking any exclusive lock. Fails with
+    // OP_INSUFFICIENT rather than overselling. Reservations are not journaled;
+    // they are held in memory until committed or released.
+    OpStatus reserve(string_view sku, int units) {
+        OperationTimer timer(metrics, METRIC_RESERVE);
+        InventoryShard& s = *shards[shardFor(sku)];
+        shared_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return timer.finish(OP_NOT_FOUND);
+        return timer.finish(s.products.stock(pos).tryReserve(units) ? OP_OK : OP_INSUFFICIENT);
+    }
+    
+    // Give back reserved units
+    OpStatus release(string_view sku, int units) {
+        OperationTimer timer(metrics, METRIC_RELEASE);
+        InventoryShard& s = *shards[shardFor(sku)];
+        shared_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return timer.finish(OP_NOT_FOUND);
+        return timer.finish(s.products.stock(pos).release(units) ? OP_OK : OP_INSUFFICIENT);
+    }
+    
+    // Turn reserved units into a sale and journal it as a delta
+    OpStatus commitReserved(const string& sku, int units, uint64_t* sequence = nullptr) {
+        OperationTimer timer(metrics, METRIC_COMMIT);
+        InventoryShard& s = *shards[shardFor(sku)];
+        shared_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return timer.finish(OP_NOT_FOUND);
+        lock_guard<mutex> order(s.commitLock);
+        int previous = s.products.stock(pos).onHand();
+        if (!s.products.stock(pos).commit(units)) return timer.finish(OP_INSUFFICIENT);
+        s.reindexQuantity(pos);
+        s.trackStock(previous, previous - units);
+        recordChange(s, pos, UNDO_VALUE, previous);
+        publish(CHANGE_UPDATE, sku, previous - units, previous);
+        uint64_t seq = log(JOURNAL_ADJUST, sku, "", -units);
+        if (sequence) *sequence = seq;
+        return timer.finish(OP_OK);
+    }
+    
+    // Apply a journaled delta to on-hand stock (replay only)
+    OpStatus adjust(const string& sku, int delta) {
+        InventoryShard& s = *shards[shardFor(sku)];
+        unique_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return OP_NOT_FOUND;
+        int previous = s.products.stock(pos).onHand();
+        s.products.stock(pos).adjust(delta);
+        s.reindexQuantity(pos);
+        s.trackStock(previous, s.products.stock(pos).onHand());
+        recordChange(s, pos, UNDO_VALUE, previous);
+        publish(CHANGE_UPDATE, sku, s.products.stock(pos).onHand(), previous);
+        return OP_OK;
+    }
+    
+    // Apply every line of a transaction or none of them. Each shard involved
+    // is locked exclusively once, in ascending shard order so concurrent
+    // transactions cannot deadlock. All lines are checked, in order, before
+    // any is applied, and the transaction is journaled as one record and
+    // versioned as one change. On failure *failedLine is the first line that
+    // could not apply (an unknown SKU, or stock below zero or what is reserved).
+    OpStatus applyTransaction(const vector<TransactionLine>& lines, size_t* failedLine = nullptr, uint64_t* sequence = nullptr) {
+        OperationTimer timer(metrics, METRIC_TRANSACTION);
+        size_t n = lines.size();
+        vector<uint32_t> lineShard(n);
+        vector<uint32_t> order;
+        order.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            lineShard[i] = shardFor(lines[i].sku);
+            order.push_back(lineShard[i]);
+        }
+        sort(order.begin(), order.end());
+        order.erase(unique(order.begin(), order.end()), order.end());
+        vector<unique_lock<shared_mutex>> guards;
+        guards.reserve(order.size());
+        for (uint32_t shardIndex : order) guards.emplace_back(shards[shardIndex]->lock);
+        
+        vector<long long> rows(n);
+        for (size_t i = 0; i < n; i++) {
+            rows[i] = shards[lineShard[i]]->skuIndex.find(lines[i].sku);
+            if (rows[i] < 0) {
+                if (failedLine) *failedLine = i;
+                return timer.finish(OP_NOT_FOUND);
+            }
+        }
+        
+        // Lines naming the same product share a running total, kept at the
+        // first such line, so repeated SKUs are checked cumulatively
+        vector<size_t> byRow(n), first(n);
+        for (size_t i = 0; i < n; i++) byRow[i] = i;
+        sort(byRow.begin(), byRow.end(), [&](size_t a, size_t b) {
+            return lineShard[a] != lineShard[b] ? lineShard[a] < lineShard[b] : rows[a] != rows[b] ? rows[a] < rows[b] : a < b;
+        });
+        for (size_t k = 0; k < n; k++) {
+            size_t i = byRow[k], prev = k > 0 ? byRow[k - 1] : i;
+            first[i] = k > 0 && lineShard[prev] == lineShard[i] && rows[prev] == rows[i] ? first[prev] : i;
+        }
+        vector<int64_t> running(n);
+        for (size_t i = 0; i < n; i++) {
+            const StockCounter& stock = shards[lineShard[i]]->products.stock(rows[i]);
+            if (first[i] == i) running[i] = stock.onHand();
+            int64_t next = running[first[i]] + lines[i].delta;
+            if (next < stock.reserved() || next > INT32_MAX) {
+                if (failedLine) *failedLine = i;
+                return timer.finish(OP_INSUFFICIENT);
+            }
+            running[first[i]] = next;
+        }
+        
+        uint64_t version = versionClock.fetch_add(1) + 1;
+        for (size_t i = 0; i < n; i++) {
+            InventoryShard& s = *shards[lineShard[i]];
+            size_t pos = rows[i];
+            int previous = s.products.stock(pos).onHand();
+            s.products.stock(pos).adjust(lines[i].delta);
+            int now = s.products.stock(pos).onHand();
+            s.reindexQuantity(pos);
+            s.trackStock(previous, now);
+            recordChange(s, pos, UNDO_VALUE, previous, version);
+            publish(CHANGE_UPDATE, lines[i].sku, now, previous);
+        }
+        if (journal && n > 0) {
+            string packed;
+            encodeTransactionLines(packed, lines);
+            uint64_t seq = log(JOURNAL_TRANSACTION, packed, "", (int32_t)n);
+            if (sequence) *sequence = seq;
+        }
+        return timer.finish(OP_OK);
+    }
+    
+    // Remove a product by tombstoning its row in O(1). The shard is compacted
+    // once tombstones pass COMPACT_TOMBSTONE_RATIO of its rows, so the cost
+    // is amortized over many deletes.
+    OpStatus erase(const string& sku, string* removedName = nullptr, uint64_t* sequence = nullptr) {
+        OperationTimer timer(metrics, METRIC_DELETE);
+        InventoryShard& s = *shards[shardFor(sku)];
+        unique_lock<shared_mutex> guard(s.lock);
+        long long pos = s.skuIndex.find(sku);
+        if (pos < 0) return timer.finish(OP_NOT_FOUND);
+        
+        // Without the name its index entry cannot be found, so the index is rebuilt
+        string name;
+        if (!s.products.name(pos, name)) s.nameIndexStale = true;
+        if (!s.nameIndexStale) s.nameIndex.erase(sku, name);
+        if (removedName) *removedName = name;
+        s.skuIndex.erase(sku);
+        int previous = s.products.stock(pos).onHand();
+        recordChange(s, pos, UNDO_DELETE, previous);
+        publish(CHANGE_DELETE, sku, 0, previous);
+        s.trackStock(previous, -1);
+        s.products.markDeleted(pos);
+        if (!s.quantityIndexStale) s.quantityIndex.remove(pos);
+        uint64_t seq = log(JOURNAL_DELETE, sku, "", 0);
+        if (sequence) *sequence = seq;
+        if (s.needsCompaction() && openViews.load() == 0) {
+            CompactionStats pass = {0, 0, 0, 0.0, 0.0};
+            compactShard(s, pass);
+        }
+        return timer.finish(OP_OK);
+    }
+    
+    // Compact every shard that has tombstones, one shard lock at a time.
+    // Compaction renumbers rows, so shards are skipped while read views are
+    // open (their undo entries and tombstoned rows are still needed).
+    CompactionStats compact() {
+        CompactionStats pass = {0, 0, 0, 0.0, 0.0};
+        for (auto& s : shards) {
+            unique_lock<shared_mutex> guard(s->lock);
+            if (s->products.tombstones() > 0 && openViews.load() == 0) compactShard(*s, pass);
+        }
+        return pass;
+    }
+    
+    // Open a read view at the current version; pair with closeView
+    uint64_t openView() {
+        lock_guard<mutex> guard(viewsLock);
+        // Lower the trim horizon before writers can see the view is open
+        oldestViewVersion = min(oldestViewVersion.load(), versionClock.load());
+        openViews++;
+        uint64_t version = versionClock.load();
+        viewVersions.insert(version);
+        oldestViewVersion = *viewVersions.begin();
+        return version;
+    }
+    
+    void closeView(uint64_t version) {
+        lock_guard<mutex> guard(viewsLock);
+        viewVersions.erase(viewVersions.find(version));
+        oldestViewVersion = viewVersions.empty() ? UINT64_MAX : *viewVersions.begin();
+        openViews--;
+    }
+    
+    // Append the products of shard i as they were at version. Holds the
+    // shard's shared lock and commit lock only while copying; newer changes
+    // are rolled back with the shard's undo entries. False if a paged-out
+    // name could not be read back.
+    bool readShardAt(size_t i, uint64_t version, vector<Product>& out) const {
+        const InventoryShard& s = *shards[i];
+        shared_lock<shared_mutex> guard(s.lock);
+        lock_guard<mutex> order(s.commitLock);
+        
+        // The first change after version to each row tells its state at version
+        unordered_map<uint32_t, const UndoEntry*> firstChange;
+        auto newer = lower_bound(s.undoLog.begin(), s.undoLog.end(), version + 1,
+                                 [](const UndoEntry& e, uint64_t v) { return e.version < v; });
+        for (auto it = newer; it != s.undoLog.end(); ++it) firstChange.emplace(it->row, &*it);
+        
+        const ProductTable& products = s.products;
+        for (size_t row = 0; row < products.rowCount(); row++) {
+            int quantity;
+            auto change = firstChange.empty() ? firstChange.end() : firstChange.find(row);
+            if (change != firstChange.end()) {
+                if (change->second->kind == UNDO_INSERT) continue;
+                quantity = change->second->previous;
+            } else {
+                if (!products.isLive(row)) continue;
+                quantity = products.stock(row).onHand();
+            }
+            out.push_back(Product{string(products.sku(row)), string(), quantity, products.stock(row).reserved()});
+            if (!products.name(row, out.back().name)) return false;
+        }
+        return true;
+    }
+    
+    // Visit every product as of one point in time without holding any lock
+    // while visiting, so slow reports never stall writers. False, with the
+    // visit cut short, if a paged-out name could not be read back.
+    template <class Visitor>
+    bool forEachAt(Visitor visit) {
+        uint64_t version = openView();
+        vector<Product> batch;
+        bool complete = true;
+        for (size_t i = 0; complete && i < shards.size(); i++) {
+            batch.clear();
+            complete = readShardAt(i, version, batch);
+            if (!complete) break;
+            for (const Product& item : batch) visit(item);
+        }
+        closeView(version);
+        return complete;
+    }
+    
+    // Open views and undo entries currently retained for them
+    void viewStats(size_t& views, size_t& undoEntries) const {
+        views = openViews.load();
+        undoEntries = 0;
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            lock_guard<mutex> order(s->commitLock);
+            undoEntries += s->undoLog.size();
+        }
+    }
+    
+    CompactionStats compactionStats() const {
+        lock_guard<mutex> guard(compactionLock);
+        return compaction;
+    }
+    
+    // Rows (live plus tombstoned), tombstones, arena bytes and dead arena bytes across all shards
+    void fragmentation(size_t& rows, size_t& tombstones, size_t& arenaBytes, size_t& deadBytes) const {
+        rows = tombstones = arenaBytes = deadBytes = 0;
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            rows += s->products.rowCount();
+            tombstones += s->products.tombstones();
+            arenaBytes += s->products.arenaBytes();
+            deadBytes += s->products.arenaBytes() - s->products.liveStringBytes();
+        }
+    }
+    
+    // Rebuild shard s's name index if a bulk load left it stale. The flag is
+    // checked under the shared lock so searches only serialize on a rebuild.
+    void refreshNameIndex(InventoryShard& s) {
+        {
+            shared_lock<shared_mutex> guard(s.lock);
+            if (!s.nameIndexStale) return;
+        }
+        unique_lock<shared_mutex> guard(s.lock);
+        if (s.nameIndexStale) s.rebuildNameIndex();
+    }
+    
+    // Exact, prefix and word matches from every shard, at most MAX_NAME_RESULTS in total
+    NameSearchResult searchByName(const string& query) {
+        OperationTimer timer(metrics, METRIC_NAME_SEARCH);
+        vector<NameMatches> perShard;
+        NameSearchResult result;
+        result.truncated = false;
+        
+        for (auto& s : shards) {
+            refreshNameIndex(*s);
+            shared_lock<shared_mutex> guard(s->lock);
+            perShard.push_back(s->nameIndex.search(query));
+        }
+        
+        size_t total = 0;
+        auto take = [&](vector<string> NameMatches::*group, vector<Product>& out) {
+            for (const NameMatches& m : perShard) {
+                if (m.truncated) result.truncated = true;
+                for (const string& sku : m.*group) {
+                    Product item;
+                    if (total >= MAX_NAME_RESULTS) {
+                        result.truncated = true;
+                        return;
+                    }
+                    if (lookup(sku, item)) {
+                        out.push_back(item);
+                        total++;
+                    }
+                }
+            }
+        };
+        take(&NameMatches::exact, result.exact);
+        take(&NameMatches::prefix, result.prefix);
+        take(&NameMatches::words, result.words);
+        timer.finish(!result.exact.empty() || !result.prefix.empty() || !result.words.empty());
+        return result;
+    }
+    
+    // Products with low <= on-hand quantity <= high in ascending quantity
+    // order, at most limit of them. Each shard answers from its quantity
+    // index and the sorted per-shard runs are merged.
+    vector<Product> quantityRange(int low, int high, size_t limit) {
+        vector<Product> result;
+        for (auto& s : shards) {
+            bool stale;
+            {
+                shared_lock<shared_mutex> guard(s->lock);
+                stale = s->quantityIndexStale;
+            }
+            if (stale) {
+                unique_lock<shared_mutex> guard(s->lock);
+                if (s->quantityIndexStale) s->rebuildQuantityIndex();
+            }
+            
+            shared_lock<shared_mutex> guard(s->lock);
+            lock_guard<mutex> order(s->quantityLock);
+            size_t runStart = result.size();
+            s->quantityIndex.scan(low, high, limit, [&](uint32_t row) {
+                Product item;
+                if (s->products.toProduct(row, item)) result.push_back(item);
+            });
+            inplace_merge(result.begin(), result.begin() + runStart, result.end(),
+                          [](const Product& a, const Product& b) { return a.quantity < b.quantity; });
+            if (result.size() > limit) result.resize(limit);
+        }
+        return result;
+    }
+    
+    // Products with on-hand quantity below threshold, lowest first
+    vector<Product> belowQuantity(int threshold, size_t limit) {
+        return threshold <= 0 ? vector<Product>() : quantityRange(0, threshold - 1, limit);
+    }
+    
+    // The limit products with the least stock on hand
+    vector<Product> lowestStock(size_t limit) { return quantityRange(0, INT32_MAX, limit); }
+    
+    // The limit products with the most stock on hand, highest first: the top
+    // of each shard's quantity index, merged
+    vector<Product> highestStock(size_t limit) {
+        vector<Product> result;
+        for (auto& s : shards) {
+            bool stale;
+            {
+                shared_lock<shared_mutex> guard(s->lock);
+                stale = s->quantityIndexStale;
+            }
+            if (stale) {
+                unique_lock<shared_mutex> guard(s->lock);
+                if (s->quantityIndexStale) s->rebuildQuantityIndex();
+            }
+            
+            shared_lock<shared_mutex> guard(s->lock);
+            lock_guard<mutex> order(s->quantityLock);
+            size_t runStart = result.size();
+            s->quantityIndex.scanDescending(limit, [&](uint32_t row) {
+                Product item;
+                if (s->products.toProduct(row, item)) result.push_back(item);
+            });
+            inplace_merge(result.begin(), result.begin() + runStart, result.end(),
+                          [](const Product& a, const Product& b) { return a.quantity > b.quantity; });
+            if (result.size() > limit) result.resize(limit);
+        }
+        return result;
+    }
+    
+    // Paging counters summed over the shards, plus the page file's size and read errors
+    PagingStats pagingStats() const {
+        PagingStats total = {pageFile != nullptr, pagingBudget, 0, 0, 0, 0, 0, 0, 0, 0};
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            size_t rows, bytes;
+            uint64_t hits, misses, evicted;
+            s->products.pagingCounters(rows, bytes, hits, misses, evicted);
+            total.residentBytes += s->products.liveStringBytes();
+            total.pagedNames += rows;
+            total.pagedBytes += bytes;
+            total.hits += hits;
+            total.misses += misses;
+            total.evictions += evicted;
+        }
+        if (pageFile) {
+            total.pageFileBytes = pageFile->bytes();
+            total.readErrors = pageFile->errors();
+        }
+        return total;
+    }
+    
+    // Product count, units on hand and out-of-stock count in O(shards),
+    // from the totals each shard keeps as its stock changes
+    StockAggregates aggregates() const {
+        StockAggregates totals = {0, 0, 0};
+        for (const auto& s : shards) {
+            totals.products += s->liveProducts.load(memory_order_relaxed);
+            totals.unitsOnHand += s->unitsOnHand.load(memory_order_relaxed);
+            totals.outOfStock += s->outOfStock.load(memory_order_relaxed);
+        }
+        return totals;
+    }
+    
+    // Products whose names are within a few typos of query, closest first
+    // across all shards, at most MAX_NAME_RESULTS of them. The edit limit is
+    // widened one step at a time and the search stops at the first distance
+    // with any match, since small limits prune far more candidates.
+    vector<FuzzyProduct> fuzzySearchByName(const string& query) {
+        OperationTimer timer(metrics, METRIC_FUZZY_SEARCH);
+        for (auto& s : shards) refreshNameIndex(*s);
+        
+        vector<FuzzyName> names;
+        int limit = NameIndex::fuzzyLimit(query.size());
+        for (int distance = 1; distance <= limit && names.empty(); distance++) {
+            for (auto& s : shards) {
+                shared_lock<shared_mutex> guard(s->lock);
+                vector<FuzzyName> found = s->nameIndex.fuzzySearch(query, distance);
+                move(found.begin(), found.end(), back_inserter(names));
+            }
+        }
+        stable_sort(names.begin(), names.end(), [](const FuzzyName& a, const FuzzyName& b) {
+            return a.distance != b.distance ? a.distance < b.distance : a.sharedTrigrams > b.sharedTrigrams;
+        });
+        
+        vector<FuzzyProduct> result;
+        for (size_t m = 0; m < names.size() && result.size() < MAX_NAME_RESULTS; m++) {
+            for (const string& sku : names[m].skus) {
+                Product item;
+                if (result.size() >= MAX_NAME_RESULTS) break;
+                if (lookup(sku, item)) result.push_back(FuzzyProduct{item, names[m].distance});
+            }
+        }
+        timer.finish(!result.empty());
+        return result;
+    }
+    
+    // Visit every stored product as (table, position), one shard at a time
+    // under its shared lock
+    template <class Visitor>
+    void forEach(Visitor visit) const {
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            for (size_t i = 0; i < s->products.rowCount(); i++) {
+                if (s->products.isLive(i)) visit(s->products, i);
+            }
+        }
+    }
+    
+    // Units on hand and reserved across all shards
+    void stockTotals(long long& onHand, long long& reserved) const {
+        onHand = reserved = 0;
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            s->products.stockTotals(onHand, reserved);
+        }
+    }
+    
+    // Bytes held by product storage, and the part of it that is string data
+    // (names paged out to disk are not counted)
+    void storageSizes(size_t& bytes, size_t& stringBytes) const {
+        bytes = stringBytes = 0;
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            bytes += s->products.memoryBytes();
+            stringBytes += s->products.residentTextBytes();
+        }
+    }
+    
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            total += s->products.size();
+        }
+        return total;
+    }
+    
+    bool empty() const { return size() == 0; }
+    
+    // Take every shard lock in shard order (shared) plus each commit lock, so
+    // nothing changes while a consistent snapshot is read
+    void lockAllShared() const {
+        for (const auto& s : shards) {
+            s->lock.lock_shared();
+            s->commitLock.lock();
+        }
+    }
+    
+    void unlockAllShared() const {
+        for (const auto& s : shards) {
+            s->commitLock.unlock();
+            s->lock.unlock_shared();
+        }
+    }
+    
+    // Turn the SKU indexes' Bloom filters off or on (for benchmarks)
+    void setSkuFilter(bool enabled) {
+        for (auto& s : shards) {
+            unique_lock<shared_mutex> guard(s->lock);
+            s->skuIndex.setFilterEnabled(enabled);
+        }
+    }
+    
+    // SKU index statistics summed over all shards
+    IndexStats indexStats() const {
+        IndexStats total = {0, 0, 0.0, 0.0, 0, 0, 0, 0};
+        double probeSum = 0;
+        for (const auto& s : shards) {
+            shared_lock<shared_mutex> guard(s->lock);
+            IndexStats one = s->skuIndex.stats();
+            total.entries += one.entries;
+            total.capacity += one.capacity;
+            probeSum += one.averageProbeLength * one.entries;
+            total.maxProbeLength = max(total.maxProbeLength, one.maxProbeLength);
+            total.filterBytes += one.filterBytes;
+            total.filterRejects += one.filterRejects;
+            total.filterFalsePositives += one.filterFalsePositives;
+        }
+        if (total.capacity > 0) total.loadFactor = (double)total.entries / total.capacity;
+        if (total.entries > 0) total.averageProbeLength = probeSum / total.entries;
+        return total;
+    }
+    
+    // Distinct names, words and name trigrams across the shards' name indexes
+    void nameIndexSizes(size_t& names, size_t& words, size_t& trigrams) {
+        names = words = trigrams = 0;
+        for (auto& s : shards) {
+            refreshNameIndex(*s);
+            shared_lock<shared_mutex> guard(s->lock);
+            names += s->nameIndex.distinctNames();
+            words += s->nameIndex.distinctWords();
+            trigrams += s->nameIndex.distinctTrigrams();
+        }
+    }
+};
+
+// Global write-ahead journal for inventory mutations
+Journal journal;
+
+// Global inventory store
+ShardedInventory inventory;
+
+// Global change feed of inventory mutations
+ChangeFeed changeFeed;
+
+// Global per-operation counters and latency histograms
+OperationMetrics metrics;
+
+// Page file for product names evicted under --memory-budget
+PageFile namePages;
+
+// Default snapshot file, overridable with --snapshot <path>
+string snapshotPath = "inventory.snap";
+
+// On-disk snapshot layout:
+//   SnapshotHeader | SnapshotShard[shardCount] | SnapshotRecord[recordCount]
+//   | SkuIndex::Slot[sum of indexSlots] | string heap
+// Records and index tables are stored shard by shard. Each record points at
+// its SKU followed by its name in the heap.
+const char SNAPSHOT_MAGIC[8] = {'I', 'N', 'V', 'S', 'N', 'A', 'P', '1'};
+// Version 4 changed the SKU hash; version 3 files still load, but their
+// saved index tables and shard layout are rebuilt
+const uint32_t SNAPSHOT_VERSION = 4;
+const uint32_t SNAPSHOT_REHASH_VERSION = 3;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t recordCount;
+    uint64_t shardCount;
+    uint64_t heapSize;
+    uint64_t lastSequence;   // last journal sequence included in the snapshot
+};
+
+struct SnapshotShard {
+    uint64_t recordCount;
+    uint64_t indexSlots;
+};
+
+// Outcome of loading a snapshot at startup
+enum SnapshotLoadResult { SNAPSHOT_LOADED, SNAPSHOT_MISSING, SNAPSHOT_INVALID };
+
+struct SnapshotRecord {
+    uint64_t heapOffset;
+    uint32_t skuLength;
+    uint32_t nameLength;
+    int32_t quantity;
+    uint32_t reserved;
+};
+
+// Write the inventory and its SKU indexes to path (via a temp file + rename).
+// All shards are held shared while writing, and lastSequence is read under
+// those locks, so the snapshot matches the journal exactly.
+bool saveSnapshot(const string& path, uint64_t& lastSequence) {
+    string tempPath = path + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) return false;
+    
+    vector<char> buffer(1 << 20);
+    setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+    
+    inventory.lockAllShared();
+    lastSequence = journal.lastSequence();
+    
+    size_t shardCount = inventory.shardCount();
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.recordCount = 0;
+    header.shardCount = shardCount;
+    header.heapSize = 0;
+    header.lastSequence = lastSequence;
+    
+    vector<SnapshotShard> sections(shardCount);
+    for (size_t s = 0; s < shardCount; s++) {
+        const InventoryShard& shard = inventory.shard(s);
+        sections[s].recordCount = shard.products.size();
+        sections[s].indexSlots = shard.skuIndex.rawSlots().size();
+        header.recordCount += shard.products.size();
+        header.heapSize += shard.products.liveTextBytes();
+    }
+    
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(sections.data(), sizeof(SnapshotShard), shardCount, file) == shardCount;
+    
+    uint64_t offset = 0;
+    for (size_t s = 0; ok && s < shardCount; s++) {
+        const ProductTable& products = inventory.shard(s).products;
+        for (size_t i = 0; i < products.rowCount(); i++) {
+            if (!products.isLive(i)) continue;
+            SnapshotRecord record = {offset, (uint32_t)products.sku(i).size(), (uint32_t)products.nameLength(i), products.stock(i).onHand(), 0};
+            ok = ok && fwrite(&record, sizeof(record), 1, file) == 1;
+            offset += record.skuLength + record.nameLength;
+        }
+    }
+    
+    // Records are written without tombstones, so a shard that has any gets
+    // its index positions renumbered on the way out
+    vector<SkuIndex::Slot> renumbered;
+    vector<uint32_t> newPosition;
+    for (size_t s = 0; ok && s < shardCount; s++) {
+        const InventoryShard& shard = inventory.shard(s);
+        const vector<SkuIndex::Slot>* slots = &shard.skuIndex.rawSlots();
+        if (shard.products.tombstones() > 0) {
+            shard.products.positionMap(newPosition);
+            renumbered = *slots;
+            for (SkuIndex::Slot& slot : renumbered) {
+                if (slot.position != SkuIndex::EMPTY_SLOT) slot.position = newPosition[slot.position];
+            }
+            slots = &renumbered;
+        }
+        ok = fwrite(slots->data(), sizeof(SkuIndex::Slot), slots->size(), file) == slots->size();
+    }
+    
+    // A name the page file cannot return fails the save, like a write error
+    string name;
+    for (size_t s = 0; ok && s < shardCount; s++) {
+        const ProductTable& products = inventory.shard(s).products;
+        for (size_t i = 0; ok && i < products.rowCount(); i++) {
+            if (!products.isLive(i)) continue;
+            string_view sku = products.sku(i);
+            ok = products.name(i, name) && fwrite(sku.data(), 1, sku.size(), file) == sku.size() &&
+                 fwrite(name.data(), 1, name.size(), file) == name.size();
+        }
+    }
+    inventory.unlockAllShared();
+    
+    ok = fflush(file) == 0 && ok;
+    ok = ok && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Map a snapshot and load it into the (empty) inventory. When the snapshot
+// was written with the same shard count, each shard's SKU index is restored
+// from the saved table instead of being rebuilt; otherwise the records are
+// re-sharded. On anything but SNAPSHOT_LOADED the inventory is left untouched.
+SnapshotLoadResult loadSnapshot(const string& path, uint64_t& lastSequence) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return SNAPSHOT_MISSING;
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return SNAPSHOT_INVALID;
+    }
+    
+    size_t fileSize = info.st_size;
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return SNAPSHOT_INVALID;
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    
+    const char* base = (const char*)mapping;
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    
+    // Validate the header, the shard table and that every section fits inside the file
+    uint64_t sectionsEnd = sizeof(SnapshotHeader) + header.shardCount * sizeof(SnapshotShard);
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                 (header.version == SNAPSHOT_VERSION || header.version == SNAPSHOT_REHASH_VERSION) &&
+                 header.headerSize == sizeof(SnapshotHeader) &&
+                 header.shardCount > 0 && header.shardCount <= 65536 &&
+                 sectionsEnd <= fileSize;
+    
+    // Each shard's counts are bounded by the bytes still unclaimed before they
+    // are multiplied or summed, so no corrupt count can wrap a size
+    const SnapshotShard* sections = (const SnapshotShard*)(base + sizeof(SnapshotHeader));
+    uint64_t totalRecords = 0, totalSlots = 0;
+    uint64_t remaining = valid ? fileSize - sectionsEnd : 0;
+    for (uint64_t s = 0; valid && s < header.shardCount; s++) {
+        uint64_t records = sections[s].recordCount, slots = sections[s].indexSlots;
+        valid = records < SkuIndex::EMPTY_SLOT && slots > 0 && (slots & (slots - 1)) == 0 &&
+                records <= remaining / sizeof(SnapshotRecord);
+        if (valid) remaining -= records * sizeof(SnapshotRecord);
+        valid = valid && slots <= remaining / sizeof(SkuIndex::Slot);
+        if (valid) remaining -= slots * sizeof(SkuIndex::Slot);
+        totalRecords += records;
+        totalSlots += slots;
+    }
+    valid = valid && totalRecords == header.recordCount && header.heapSize == remaining;
+    uint64_t recordsEnd = valid ? sectionsEnd + totalRecords * sizeof(SnapshotRecord) : 0;
+    uint64_t slotsEnd = valid ? recordsEnd + totalSlots * sizeof(SkuIndex::Slot) : 0;
+    if (!valid) {
+        munmap(mapping, fileSize);
+        return SNAPSHOT_INVALID;
+    }
+    
+    const SnapshotRecord* records = (const SnapshotRecord*)(base + sectionsEnd);
+    const SkuIndex::Slot* slots = (const SkuIndex::Slot*)(base + recordsEnd);
+    const char* heap = base + slotsEnd;
+    // Each record's strings lie inside the heap; compared by subtraction so a
+    // corrupt offset near 2^64 cannot wrap past the check. Records must also
+    // hold what an insert would accept: a SKU and a non-negative quantity.
+    for (uint64_t i = 0; i < header.recordCount; i++) {
+        const SnapshotRecord& r = records[i];
+        if (r.skuLength == 0 || r.quantity < 0 ||
+            r.heapOffset > header.heapSize || r.skuLength > header.heapSize - r.heapOffset ||
+            r.nameLength > header.heapSize - r.heapOffset - r.skuLength) {
+            munmap(mapping, fileSize);
+            return SNAPSHOT_INVALID;
+        }
+    }
+    
+    // A saved SKU index is adopted as is, so each occupied slot must point at
+    // a record of its own shard, and one slot per record must be occupied
+    // with at least one left empty to end probes
+    bool adoptIndexes = header.shardCount == inventory.shardCount() && header.version == SNAPSHOT_VERSION;
+    const SkuIndex::Slot* slot = slots;
+    for (uint64_t s = 0; adoptIndexes && s < header.shardCount; s++) {
+        uint64_t occupied = 0;
+        for (uint64_t i = 0; i < sections[s].indexSlots; i++, slot++) {
+            if (slot->position == SkuIndex::EMPTY_SLOT) continue;
+            if (slot->position >= sections[s].recordCount) {
+                munmap(mapping, fileSize);
+                return SNAPSHOT_INVALID;
+            }
+            occupied++;
+        }
+        if (occupied != sections[s].recordCount || occupied == sections[s].indexSlots) {
+            munmap(mapping, fileSize);
+            return SNAPSHOT_INVALID;
+        }
+    }
+    
+    // Re-sharded records are indexed without a lookup, so a SKU saved twice
+    // is rejected before anything is loaded
+    if (!adoptIndexes) {
+        unordered_set<string_view> seen;
+        seen.reserve(header.recordCount);
+        for (uint64_t i = 0; i < header.recordCount; i++) {
+            if (!seen.insert(string_view(heap + records[i].heapOffset, records[i].skuLength)).second) {
+                munmap(mapping, fileSize);
+                return SNAPSHOT_INVALID;
+            }
+        }
+    }
+    
+    if (adoptIndexes) {
+        for (uint64_t s = 0; s < header.shardCount; s++) {
+            InventoryShard& shard = inventory.shard(s);
+            unique_lock<shared_mutex> guard(shard.lock);
+            uint64_t stringBytes = 0;
+            for (uint64_t i = 0; i < sections[s].recordCount; i++) stringBytes += records[i].skuLength + records[i].nameLength;
+            shard.products.reserve(sections[s].recordCount, stringBytes);
+            for (uint64_t i = 0; i < sections[s].recordCount; i++) {
+                const SnapshotRecord& r = *records++;
+                const char* sku = heap + r.heapOffset;
+                shard.products.push(string_view(sku, r.skuLength), string_view(sku + r.skuLength, r.nameLength), r.quantity);
+                shard.products.trimToBudget();
+            }
+            shard.skuIndex.adopt(slots, sections[s].indexSlots, sections[s].recordCount);
+            slots += sections[s].indexSlots;
+            shard.recountStock();
+            shard.nameIndexStale = true;
+            shard.quantityIndexStale = true;
+        }
+    } else {
+        for (uint64_t i = 0; i < header.recordCount; i++) {
+            const SnapshotRecord& r = records[i];
+            string_view sku(heap + r.heapOffset, r.skuLength);
+            uint32_t hash = SkuIndex::hashSku(sku);
+            InventoryShard& shard = inventory.shard(inventory.shardOf(hash));
+            size_t pos = shard.products.push(sku, string_view(heap + r.heapOffset + r.skuLength, r.nameLength), r.quantity);
+            shard.skuIndex.insertHashed(hash, pos);
+            shard.products.trimToBudget();
+            shard.trackStock(-1, r.quantity);
+            shard.nameIndexStale = true;
+            shard.quantityIndexStale = true;
+        }
+    }
+    
+    lastSequence = header.lastSequence;
+    munmap(mapping, fileSize);
+    return SNAPSHOT_LOADED;
+}
+
+// Apply one journal record to store, which must not have a journal attached
+void applyJournalRecord(ShardedInventory& store, const JournalRecord& record) {
+    if (record.op == JOURNAL_INSERT) {
+        store.insert(record.sku, record.name, record.quantity);
+    } else if (record.op == JOURNAL_UPDATE) {
+        store.update(record.sku, record.quantity);
+    } else if (record.op == JOURNAL_ADJUST) {
+        store.adjust(record.sku, record.quantity);
+    } else if (record.op == JOURNAL_DELETE) {
+        store.erase(record.sku);
+    } else if (record.op == JOURNAL_TRANSACTION) {
+        vector<TransactionLine> lines;
+        if (decodeTransactionLines(record.sku, lines)) store.applyTransaction(lines);
+    }
+}
+
+// Re-apply journal records newer than afterSequence. A torn or corrupt tail
+// (e.g. from a crash mid-write) is cut off so new records append cleanly.
+// Returns the number of records applied and updates lastSequence.
+size_t replayJournal(const string& path, uint64_t afterSequence, uint64_t& lastSequence) {
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) return 0;
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    
+    size_t fileSize = info.st_size;
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    
+    const char* data = (const char*)mapping;
+    size_t offset = 0, applied = 0;
+    JournalRecord record;
+    while (size_t used = decodeJournalRecord(data + offset, fileSize - offset, record)) {
+        offset += used;
+        if (record.sequence <= afterSequence) continue;
+        
+        applyJournalRecord(inventory, record);
+        lastSequence = max(lastSequence, record.sequence);
+        applied++;
+    }
+    
+    munmap(mapping, fileSize);
+    if (offset < fileSize && ftruncate(fd, offset) != 0) {
+        cout << "Warning: could not truncate damaged journal tail." << endl;
+    }
+    close(fd);
+    return applied;
+}
+
+// Default journal file, overridable with --journal <path>
+string journalPath = "inventory.wal";
+
+// Wait for a journaled mutation according to the commit mode and report failures
+void commitMutation(uint64_t sequence) {
+    if (!journal.commit(sequence)) {
+        cout << "Warning: change could not be written to the journal." << endl;
+    }
+}
+
+// A numeric address is a loopback TCP port, anything else a Unix socket path
+bool isTcpAddress(const string& address) {
+    uint16_t port;
+    return parseNumber(address, port);
+}
+
+// Port number of a TCP address
+uint16_t tcpPort(const string& address) {
+    uint16_t port = 0;
+    parseNumber(address, port);
+    return port;
+}
+
+// Create a listening socket for address, or -1
+int openListener(const string& address) {
+    int fd;
+    if (isTcpAddress(address)) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) return -1;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(tcpPort(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    } else {
+        sockaddr_un addr = {};
+        if (address.size() >= sizeof(addr.sun_path)) return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) return -1;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        unlink(address.c_str());
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 128) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connect to a server address (blocking socket), or -1
+int connectTo(const string& address) {
+    int fd;
+    if (isTcpAddress(address)) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(tcpPort(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    } else {
+        sockaddr_un addr = {};
+        if (address.size() >= sizeof(addr.sun_path)) return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Write all of data to a blocking socket
+bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = write(fd, data, size);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Replication stream from a leader to its followers (little-endian, no
+// padding). A follower connects and sends
+//   [u32 REPLICATION_MAGIC][u64 last sequence it has applied]
+// and then [u64 applied sequence] after each message it applies. The leader
+// sends messages of
+//   [u8 kind][u32 payloadLength][u64 sequence][i64 durableNanos][payload]
+// REPL_RECORDS carries journal frames, whole group commits that may start
+// before what the follower has; sequence is the leader's newest durable
+// record and durableNanos when the last frame became durable. REPL_HEARTBEAT
+// is sent when there is nothing new. A follower the log cannot serve first
+// gets REPL_SNAPSHOT_BEGIN, REPL_SNAPSHOT_ROWS (an insert frame per product)
+// and REPL_SNAPSHOT_END, all carrying the sequence the snapshot was taken at.
+enum ReplicationKind : uint8_t {
+    REPL_RECORDS = 1, REPL_HEARTBEAT = 2, REPL_SNAPSHOT_BEGIN = 3, REPL_SNAPSHOT_ROWS = 4, REPL_SNAPSHOT_END = 5
+};
+const uint32_t REPLICATION_MAGIC = 0x52564E49;  // "INVR"
+const size_t REPLICATION_HEADER = 21;
+// Payload bytes the leader aims for per message, and the most a follower accepts
+const size_t REPLICATION_CHUNK = 1 << 20;
+const uint32_t REPLICATION_MAX_PAYLOAD = 64 << 20;
+// Heartbeat interval, and how long a follower waits for any message before reconnecting
+const int REPLICATION_HEARTBEAT_MS = 100;
+const int REPLICATION_SILENCE_MS = 5000;
+
+void encodeReplicationHeader(char* out, uint8_t kind, uint32_t length, uint64_t sequence, int64_t durableNanos) {
+    out[0] = (char)kind;
+    memcpy(out + 1, &length, 4);
+    memcpy(out + 5, &sequence, 8);
+    memcpy(out + 13, &durableNanos, 8);
+}
+
+// Replication state of a leader or a follower
+struct ReplicationStats {
+    bool connected;        // follower: connected to its leader
+    size_t followers;      // leader: followers connected
+    uint64_t sequence;     // leader: newest durable record; follower: newest applied
+    uint64_t lagRecords;   // leader: furthest behind any follower is; follower: records behind its leader
+    double lagMs;          // follower: durable on the leader to applied here, last batch
+    double averageLagMs;
+    double maxLagMs;
+    uint64_t snapshots;    // snapshots sent / installed
+    uint64_t bytes;        // bytes sent / received
+};
+
+// Ships the journal to followers over a Unix socket or loopback TCP port.
+// Each follower gets a thread that streams the replication log from the
+// follower's position, or a snapshot first when the log no longer reaches
+// back that far.
+class ReplicationLeader {
+private:
+    struct Follower {
+        int fd;
+        thread worker;
+        atomic<uint64_t> acked;
+        atomic<bool> done;
+    };
+    
+    ShardedInventory& store;
+    Journal& journal;
+    ReplicationLog& log;
+    string address;
+    int listener;
+    thread acceptor;
+    atomic<bool> stopping;
+    mutex followersLock;
+    vector<unique_ptr<Follower>> followers;
+    atomic<uint64_t> snapshots;
+    atomic<uint64_t> bytesSent;
+    
+    bool sendMessage(int fd, uint8_t kind, string_view payload, uint64_t sequence, int64_t durableNanos) {
+        char header[REPLICATION_HEADER];
+        encodeReplicationHeader(header, kind, payload.size(), sequence, durableNanos);
+        if (!sendAll(fd, header, sizeof(header)) || !sendAll(fd, payload.data(), payload.size())) return false;
+        bytesSent.fetch_add(sizeof(header) + payload.size(), memory_order_relaxed);
+        return true;
+    }
+    
+    // Send every product as of one journal sequence, which becomes position.
+    // All shard locks are held only to pair that sequence with a read view;
+    // rows are then copied one shard at a time, encoded with no lock held and
+    // sent once the view is closed and the sequence is durable.
+    bool sendSnapshot(int fd, uint64_t& position) {
+        store.lockAllShared();
+        uint64_t sequence = journal.lastSequence();
+        uint64_t version = store.openView();
+        store.unlockAllShared();
+        
+        vector<string> parts(1);
+        vector<Product> rows;
+        bool complete = true;
+        for (size_t s = 0; complete && s < store.shardCount(); s++) {
+            rows.clear();
+            complete = store.readShardAt(s, version, rows);
+            for (const Product& item : rows) {
+                if (parts.back().size() >= REPLICATION_CHUNK) parts.emplace_back();
+                encodeJournalRecord(parts.back(), sequence, JOURNAL_INSERT, item.sku, item.name, item.quantity);
+            }
+        }
+        store.closeView(version);
+        // A name the page file cannot return drops the follower, which retries
+        if (!complete || !journal.waitDurable(sequence) || !sendMessage(fd, REPL_SNAPSHOT_BEGIN, string_view(), sequence, 0)) return false;
+        for (const string& part : parts) {
+            if (!sendMessage(fd, REPL_SNAPSHOT_ROWS, part, sequence, 0)) return false;
+        }
+        if (!sendMessage(fd, REPL_SNAPSHOT_END, string_view(), sequence, 0)) return false;
+        position = sequence;
+        snapshots++;
+        return true;
+    }
+    
+    void serveFollower(Follower* f) {
+        char hello[12];
+        timeval wait = {5, 0};
+        setsockopt(f->fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        bool ok = recv(f->fd, hello, sizeof(hello), MSG_WAITALL) == sizeof(hello);
+        uint32_t magic = 0;
+        uint64_t position = 0;
+        memcpy(&magic, hello, 4);
+        memcpy(&position, hello + 4, 8);
+        ok = ok && magic == REPLICATION_MAGIC;
+        f->acked = position;
+        
+        string frames, acks;
+        char received[256];
+        while (ok && !stopping) {
+            uint64_t through = 0;
+            int64_t durableNanos = 0;
+            LogRead status = log.read(position, frames, through, durableNanos, REPLICATION_CHUNK, REPLICATION_HEARTBEAT_MS);
+            if (status == LOG_CLOSED) break;
+            if (status == LOG_RESYNC) {
+                ok = sendSnapshot(f->fd, position);
+            } else if (status == LOG_OK) {
+                ok = sendMessage(f->fd, REPL_RECORDS, frames, log.lastSequence(), durableNanos);
+                position = through;
+            } else {
+                ok = sendMessage(f->fd, REPL_HEARTBEAT, string_view(), log.lastSequence(), 0);
+            }
+            
+            // Take the newest acknowledgement without waiting for one
+            ssize_t got;
+            while (ok && (got = recv(f->fd, received, sizeof(received), MSG_DONTWAIT)) != 0) {
+                if (got < 0) {
+                    ok = errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                    break;
+                }
+                acks.append(received, got);
+            }
+            ok = ok && got != 0;
+            if (acks.size() >= 8) {
+                size_t whole = acks.size() / 8 * 8;
+                uint64_t acked;
+                memcpy(&acked, acks.data() + whole - 8, 8);
+                f->acked = acked;
+                acks.erase(0, whole);
+            }
+        }
+        shutdown(f->fd, SHUT_RDWR);
+        f->done = true;
+    }
+    
+    void acceptLoop() {
+        while (!stopping) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;
+            }
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            
+            lock_guard<mutex> guard(followersLock);
+            // Reap followers that have disconnected
+            for (size_t i = 0; i < followers.size();) {
+                if (followers[i]->done) {
+                    followers[i]->worker.join();
+                    ::close(followers[i]->fd);
+                    followers.erase(followers.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+            Follower* f = new Follower();
+            f->fd = fd;
+            f->acked = 0;
+            f->done = false;
+            followers.emplace_back(f);
+            f->worker = thread(&ReplicationLeader::serveFollower, this, f);
+        }
+    }
+    
+public:
+    ReplicationLeader(ShardedInventory& source, Journal& sourceJournal, ReplicationLog& shipped)
+        : store(source), journal(sourceJournal), log(shipped), listener(-1), stopping(false), snapshots(0), bytesSent(0) {}
+    
+    ~ReplicationLeader() { stop(); }
+    
+    // Listen for followers on address and ship every record the (open)
+    // journal makes durable from now on
+    bool start(const string& where) {
+        listener = openListener(where);
+        if (listener < 0) return false;
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) & ~O_NONBLOCK);
+        address = where;
+        signal(SIGPIPE, SIG_IGN);
+        journal.attachReplicationLog(&log);
+        stopping = false;
+        acceptor = thread(&ReplicationLeader::acceptLoop, this);
+        return true;
+    }
+    
+    bool running() const { return listener >= 0; }
+    
+    ReplicationStats stats() {
+        ReplicationStats r = {};
+        r.sequence = log.lastSequence();
+        r.snapshots = snapshots;
+        r.bytes = bytesSent;
+        lock_guard<mutex> guard(followersLock);
+        for (const auto& f : followers) {
+            if (f->done) continue;
+            r.followers++;
+            r.lagRecords = max(r.lagRecords, r.sequence - min(f->acked.load(), r.sequence));
+        }
+        return r;
+    }
+    
+    // Disconnect every follower and stop listening
+    void stop() {
+        if (listener < 0) return;
+        stopping = true;
+        log.close();
+        shutdown(listener, SHUT_RDWR);
+        acceptor.join();
+        lock_guard<mutex> guard(followersLock);
+        for (const auto& f : followers) shutdown(f->fd, SHUT_RDWR);
+        for (const auto& f : followers) {
+            f->worker.join();
+            ::close(f->fd);
+        }
+        followers.clear();
+        journal.attachReplicationLog(nullptr);
+        ::close(listener);
+        listener = -1;
+        if (!isTcpAddress(address)) unlink(address.c_str());
+    }
+};
+
+// Keeps store a read-only copy of a leader's inventory. A background thread
+// connects (and reconnects) to the leader, applies the records it streams
+// and acknowledges them. Applied records go to the local journal under the
+// leader's sequence numbers, so a restarted follower reloads its own
+// snapshot and journal and asks the leader only for what it is missing.
+class ReplicaFollower {
+private:
+    ShardedInventory& store;
+    Journal* journal;
+    void (*resynced)();
+    string address;
+    thread worker;
+    mutex applying;
+    mutable mutex progressLock;
+    condition_variable progress;
+    atomic<bool> stopping;
+    atomic<bool> connected;
+    atomic<uint64_t> applied;
+    atomic<uint64_t> leaderSequence;
+    atomic<uint64_t> snapshots;
+    atomic<uint64_t> bytesReceived;
+    bool resyncNeeded;
+    double lastLagMs, lagSumMs, maxLagMs;
+    uint64_t lagSamples;
+    
+    // Read exactly size bytes; false on error, end of stream, stop() or a
+    // leader silent for longer than REPLICATION_SILENCE_MS
+    bool readFully(int fd, char* data, size_t size) {
+        auto start = chrono::steady_clock::now();
+        while (size > 0) {
+            ssize_t got = read(fd, data, size);
+            if (got > 0) {
+                data += got;
+                size -= got;
+                continue;
+            }
+            if (got == 0 || stopping || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) return false;
+            if (chrono::steady_clock::now() - start > chrono::milliseconds(REPLICATION_SILENCE_MS)) return false;
+        }
+        return true;
+    }
+    
+    // Apply the records in frames newer than what is applied and append them
+    // to the local journal; false if the frames are damaged or skip a record
+    bool applyRecords(const string& frames) {
+        lock_guard<mutex> guard(applying);
+        JournalRecord record;
+        uint64_t done = applied, count = 0;
+        size_t at = 0, firstNew = 0, end = 0;
+        bool ok = true;
+        while (at < frames.size()) {
+            size_t used = decodeJournalRecord(frames.data() + at, frames.size() - at, record);
+            if (used == 0 || (record.sequence > done && record.sequence != done + 1)) {
+                ok = false;
+                break;
+            }
+            if (record.sequence > done) {
+                if (count++ == 0) firstNew = at;
+                applyJournalRecord(store, record);
+                done = record.sequence;
+                end = at + used;
+            }
+            at += used;
+        }
+        if (count > 0) {
+            if (journal) journal->appendReplicated(string_view(frames).substr(firstNew, end - firstNew), count, done);
+            applied = done;
+        }
+        return ok;
+    }
+    
+    // Upsert the products in one REPL_SNAPSHOT_ROWS payload, noting their SKUs
+    bool installRows(const string& frames, unordered_set<string>& skus) {
+        JournalRecord record;
+        Product current;
+        for (size_t at = 0; at < frames.size();) {
+            size_t used = decodeJournalRecord(frames.data() + at, frames.size() - at, record);
+            if (used == 0 || record.op != JOURNAL_INSERT) return false;
+            at += used;
+            if (!store.find(record.sku, current)) {
+                store.insert(record.sku, record.name, record.quantity);
+            } else if (current.name != record.name) {
+                store.erase(record.sku);
+                store.insert(record.sku, record.name, record.quantity);
+            } else if (current.quantity != record.quantity) {
+                store.update(record.sku, record.quantity);
+            }
+            skus.insert(move(record.sku));
+        }
+        return true;
+    }
+    
+    // Finish a snapshot taken at sequence: delete every product it did not
+    // list, then persist the result
+    void finishSnapshot(uint64_t sequence, const unordered_set<string>& skus) {
+        vector<string> stale;
+        store.forEach([&](const ProductTable& products, size_t i) {
+            string sku(products.sku(i));
+            if (!skus.count(sku)) stale.push_back(move(sku));
+        });
+        for (const string& sku : stale) store.erase(sku);
+        if (journal) journal->restartAt(sequence);
+        applied = sequence;
+        snapshots++;
+        if (resynced) resynced();
+    }
+    
+    void recordLag(int64_t durableNanos) {
+        double ms = (steadyNanos() - durableNanos) / 1e6;
+        lock_guard<mutex> guard(progressLock);
+        lastLagMs = ms;
+        lagSumMs += ms;
+        maxLagMs = max(maxLagMs, ms);
+        lagSamples++;
+    }
+    
+    // Apply messages until the connection fails or stop() is called. While a
+    // snapshot is being installed the apply lock stays held, so saves wait
+    // for a consistent inventory; readers may see a mix of old and new rows.
+    void follow(int fd) {
+        char header[REPLICATION_HEADER];
+        string payload;
+        unique_lock<mutex> installing(applying, defer_lock);
+        unordered_set<string> snapshotSkus;
+        while (!stopping && readFully(fd, header, sizeof(header))) {
+            uint8_t kind = (uint8_t)header[0];
+            uint32_t length;
+            uint64_t sequence;
+            int64_t durableNanos;
+            memcpy(&length, header + 1, 4);
+            memcpy(&sequence, header + 5, 8);
+            memcpy(&durableNanos, header + 13, 8);
+            if (length > REPLICATION_MAX_PAYLOAD) return;
+            payload.resize(length);
+            if (!readFully(fd, &payload[0], length)) return;
+            bytesReceived.fetch_add(REPLICATION_HEADER + length, memory_order_relaxed);
+            
+            bool installingSnapshot = installing.owns_lock();
+            if ((kind == REPL_RECORDS || kind == REPL_HEARTBEAT) && !installingSnapshot) {
+                if (kind == REPL_RECORDS) {
+                    if (!applyRecords(payload)) return;
+                    recordLag(durableNanos);
+                }
+                leaderSequence = sequence;
+            } else if (kind == REPL_SNAPSHOT_BEGIN && !installingSnapshot) {
+                installing.lock();
+                resyncNeeded = true;
+                snapshotSkus.clear();
+            } else if (kind == REPL_SNAPSHOT_ROWS && installingSnapshot) {
+                if (!installRows(payload, snapshotSkus)) return;
+            } else if (kind == REPL_SNAPSHOT_END && installingSnapshot) {
+                finishSnapshot(sequence, snapshotSkus);
+                leaderSequence = max(leaderSequence.load(), sequence);
+                resyncNeeded = false;
+                installing.unlock();
+                snapshotSkus.clear();
+            } else {
+                return;
+            }
+            
+            if (kind == REPL_RECORDS || kind == REPL_SNAPSHOT_END) {
+                uint64_t ack = applied;
+                if (!sendAll(fd, (const char*)&ack, 8)) return;
+            }
+            lock_guard<mutex> guard(progressLock);
+            progress.notify_all();
+        }
+    }
+    
+    void run() {
+        while (!stopping) {
+            int fd = connectTo(address);
+            if (fd >= 0) {
+                // Time reads out so stop() and a silent leader are noticed
+                timeval wait = {0, 200000};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+                // A half-installed snapshot matches no sequence; claiming to
+                // be ahead of the leader makes it send a new one
+                uint64_t from = resyncNeeded ? UINT64_MAX : applied.load();
+                char hello[12];
+                memcpy(hello, &REPLICATION_MAGIC, 4);
+                memcpy(hello + 4, &from, 8);
+                if (sendAll(fd, hello, sizeof(hello))) {
+                    connected = true;
+                    follow(fd);
+                    connected = false;
+                }
+                ::close(fd);
+            }
+            unique_lock<mutex> guard(progressLock);
+            progress.wait_for(guard, chrono::milliseconds(200), [this] { return stopping.load(); });
+        }
+    }
+    
+public:
+    // Local journal to append applied records to (may be null), and a
+    // function to call, with the apply lock held, after a snapshot is installed
+    ReplicaFollower(ShardedInventory& target, Journal* targetJournal = nullptr, void (*onResync)() = nullptr)
+        : store(target), journal(targetJournal), resynced(onResync), stopping(false), connected(false), applied(0),
+          leaderSequence(0), snapshots(0), bytesReceived(0), resyncNeeded(false), lastLagMs(0), lagSumMs(0),
+          maxLagMs(0), lagSamples(0) {}
+    
+    ~ReplicaFollower() { stop(); }
+    
+    // Follow the leader at address, starting after appliedSequence (the
+    // sequence the local snapshot and journal reach); store must have no
+    // journal attached
+    void start(const string& leader, uint64_t appliedSequence) {
+        address = leader;
+        applied = leaderSequence = appliedSequence;
+        stopping = false;
+        signal(SIGPIPE, SIG_IGN);
+        worker = thread(&ReplicaFollower::run, this);
+    }
+    
+    bool running() const { return worker.joinable(); }
+    
+    // Held while a batch or snapshot is applied; hold it to save a snapshot
+    // that matches the journal
+    mutex& applyLock() { return applying; }
+    
+    // Wait until every record up to sequence is applied; false on timeout
+    bool waitFor(uint64_t sequence, int timeoutMs) {
+        unique_lock<mutex> guard(progressLock);
+        return progress.wait_for(guard, chrono::milliseconds(timeoutMs), [&] { return applied >= sequence; });
+    }
+    
+    ReplicationStats stats() const {
+        lock_guard<mutex> guard(progressLock);
+        ReplicationStats r = {};
+        r.connected = connected;
+        r.sequence = applied;
+        uint64_t head = leaderSequence;
+        r.lagRecords = head > r.sequence ? head - r.sequence : 0;
+        r.lagMs = lastLagMs;
+        r.averageLagMs = lagSamples ? lagSumMs / lagSamples : 0;
+        r.maxLagMs = maxLagMs;
+        r.snapshots = snapshots;
+        r.bytes = bytesReceived;
+        return r;
+    }
+    
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            lock_guard<mutex> guard(progressLock);
+            stopping = true;
+            progress.notify_all();
+        }
+        worker.join();
+    }
+};
+
+// Journal records held for followers with --leader
+ReplicationLog replicationLog;
+
+// Ships the journal to followers with --leader <address>
+ReplicationLeader replicationLeader(inventory, journal, replicationLog);
+
+// Persist a snapshot a replica just installed, so a restart resumes from it
+void saveResyncedReplica() {
+    uint64_t covered = 0;
+    if (saveSnapshot(snapshotPath, covered)) journal.checkpoint(covered);
+}
+
+// Applies a leader's stream to the inventory with --follow <address>
+ReplicaFollower replica(inventory, &journal, saveResyncedReplica);
+
+// Refuse a change on a read-only replica; true if the caller may go ahead
+bool writable() {
+    if (!replica.running()) return true;
+    cout << "This is a read-only replica; make changes on the leader." << endl;
+    return false;
+}
+// Run task(0) .. task(count - 1) on a pool of worker threads
+template <class Task>
+void parallelFor(size_t count, Task task) {
+    size_t workers = min<size_t>(count, max(1u, thread::hardware_concurrency()));
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (size_t w = 0; w < workers; w++) {
+        pool.emplace_back([&] {
+            for (size_t i; (i = next.fetch_add(1)) < count;) task(i);
+        });
+    }
+    for (auto& t : pool) t.join();
+}
+
+// One parsed import row; sku and name point into the mapped file
+struct ImportRow {
+    string_view sku;
+    string_view name;
+    int32_t quantity;
+    uint32_t hash;
+};
+
+// Rows parsed from one chunk of the import file, bucketed by shard
+struct ImportChunk {
+    const char* begin;
+    const char* end;
+    vector<vector<ImportRow>> rows;
+    size_t lines;
+    size_t rejected;
+    size_t firstBadLine;      // chunk-relative line number of the first rejected line, 0 if none
+    deque<string> unescaped;    // quoted fields with doubled quotes, which rows point into
+};
+
+// Summary printed after a bulk import
+struct ImportReport {
+    size_t imported;
+    size_t duplicates;
+    size_t rejected;
+    size_t firstBadLine;
+    double parseMs;
+    double loadMs;
+};
+
+// End of the record starting at p: the first newline outside a quoted
+// field. Records without a quote end at the first newline.
+const char* recordEnd(const char* p, const char* end, char delimiter) {
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    if (!newline) newline = end;
+    if (!memchr(p, '"', newline - p)) return newline;
+    bool fieldStart = true;
+    while (p < end) {
+        if (fieldStart && *p == '"') {
+            for (p++; p < end; p++) {
+                if (*p != '"') continue;
+                if (p + 1 < end && p[1] == '"') p++;
+                else break;
+            }
+            if (p == end) return end;
+            p++;
+            fieldStart = false;
+            continue;
+        }
+        if (*p == '\n') return p;
+        fieldStart = *p == delimiter;
+        p++;
+    }
+    return end;
+}
+
+// Read one field starting at p. Fields may be wrapped in double quotes (RFC
+// 4180), in which case they may hold the delimiter and line breaks, and a
+// doubled quote stands for one; such fields are unescaped into unescaped.
+const char* nextField(const char* p, const char* lineEnd, char delimiter, string_view& field, deque<string>& unescaped) {
+    if (p < lineEnd && *p == '"') {
+        const char* close = p + 1;
+        bool doubled = false;
+        while ((close = (const char*)memchr(close, '"', lineEnd - close)) && close + 1 < lineEnd && close[1] == '"') {
+            doubled = true;
+            close += 2;
+        }
+        if (close) {
+            field = string_view(p + 1, close - p - 1);
+            if (doubled) {
+                string& text = unescaped.emplace_back();
+                for (size_t i = 0; i < field.size(); i++) {
+                    text += field[i];
+                    if (field[i] == '"') i++;
+                }
+                field = text;
+            }
+            p = close + 1;
+            return (p < lineEnd && *p == delimiter) ? p + 1 : p;
+        }
+    }
+    const char* stop = (const char*)memchr(p, delimiter, lineEnd - p);
+    if (!stop) stop = lineEnd;
+    field = string_view(p, stop - p);
+    return stop < lineEnd ? stop + 1 : stop;
+}
+
+// Parse "sku<d>name<d>quantity" with the same rules as insertProduct
+bool parseImportLine(const char* line, const char* lineEnd, char delimiter, ImportRow& row, deque<string>& unescaped) {
+    if (lineEnd > line && lineEnd[-1] == '\r') lineEnd--;
+    
+    string_view quantity;
+    const char* p = nextField(line, lineEnd, delimiter, row.sku, unescaped);
+    p = nextField(p, lineEnd, delimiter, row.name, unescaped);
+    p = nextField(p, lineEnd, delimiter, quantity, unescaped);
+    if (p != lineEnd || row.sku.empty() || row.name.empty() || quantity.empty()) return false;
+    
+    if (!parseNumber(quantity, row.quantity, 0)) return false;
+    
+    row.hash = SkuIndex::hashSku(row.sku);
+    return true;
+}
+
+// Worker: parse every record of one chunk
+void parseImportChunk(ImportChunk& chunk, char delimiter) {
+    chunk.rows.resize(inventory.shardCount());
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* lineEnd = recordEnd(p, chunk.end, delimiter);
+        chunk.lines++;
+        
+        ImportRow row;
+        if (parseImportLine(p, lineEnd, delimiter, row, chunk.unescaped)) {
+            chunk.rows[inventory.shardOf(row.hash)].push_back(row);
+        } else if (lineEnd > p && !(lineEnd - p == 1 && *p == '\r')) {
+            chunk.rejected++;
+            if (chunk.firstBadLine == 0) chunk.firstBadLine = chunk.lines;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+// Bulk-load a CSV or TSV file (sku, name, quantity per line). The file is
+// mapped, split into record-aligned chunks and parsed in parallel into
+// per-shard buckets; each shard then checks its rows against its SKU index
+// and appends them in one pass, shards in parallel. A first line whose
+// quantity is not a number is treated as a header.
+bool importFile(const string& path, ImportReport& report) {
+    report = ImportReport{0, 0, 0, 0, 0.0, 0.0};
+    auto parseStart = chrono::high_resolution_clock::now();
+    
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t fileSize = info.st_size;
+    if (fileSize == 0) {
+        close(fd);
+        return true;
+    }
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    
+    const char* data = (const char*)mapping;
+    const char* end = data + fileSize;
+    
+    // Tab-separated if the first line has a tab, otherwise comma-separated
+    const char* firstEnd = (const char*)memchr(data, '\n', fileSize);
+    if (!firstEnd) firstEnd = end;
+    char delimiter = memchr(data, '\t', firstEnd - data) ? '\t' : ',';
+    
+    ImportRow headerCheck;
+    deque<string> headerText;
+    const char* body = data;
+    firstEnd = recordEnd(data, end, delimiter);
+    if (!parseImportLine(data, firstEnd, delimiter, headerCheck, headerText)) {
+        body = firstEnd < end ? firstEnd + 1 : end;
+    }
+    
+    // Split into record-aligned chunks, a few per worker for load balance. A
+    // quoted field may span lines, so once the file has a quote the chunk
+    // ends are found by walking records from the start of the chunk.
+    size_t chunkCount = max(1u, thread::hardware_concurrency()) * 4;
+    size_t chunkSize = max<size_t>(1 << 16, (end - body) / chunkCount + 1);
+    bool quoted = memchr(body, '"', end - body) != nullptr;
+    vector<ImportChunk> chunks;
+    for (const char* p = body; p < end;) {
+        const char* stop = p + min<size_t>(chunkSize, end - p);
+        if (stop < end && quoted) {
+            const char* record = p;
+            while (record < stop) record = recordEnd(record, end, delimiter) + 1;
+            stop = min(record, end);
+        } else if (stop < end) {
+            const char* nl = (const char*)memchr(stop, '\n', end - stop);
+            stop = nl ? nl + 1 : end;
+        }
+        chunks.push_back(ImportChunk{p, stop, {}, 0, 0, 0, {}});
+        p = stop;
+    }
+    
+    parallelFor(chunks.size(), [&](size_t i) { parseImportChunk(chunks[i], delimiter); });
+    
+    auto loadStart = chrono::high_resolution_clock::now();
+    report.parseMs = chrono::duration<double, milli>(loadStart - parseStart).count();
+    
+    size_t lineBase = body == data ? 0 : 1;
+    for (const ImportChunk& chunk : chunks) {
+        report.rejected += chunk.rejected;
+        if (report.firstBadLine == 0 && chunk.firstBadLine != 0) report.firstBadLine = lineBase + chunk.firstBadLine;
+        lineBase += chunk.lines;
+    }
+    
+    // Each shard sizes its store and index once, then checks and appends its
+    // rows in file order (equal SKUs always land in the same shard)
+    vector<size_t> imported(inventory.shardCount(), 0);
+    parallelFor(inventory.shardCount(), [&](size_t s) {
+        InventoryShard& shard = inventory.shard(s);
+        unique_lock<shared_mutex> guard(shard.lock);
+        size_t rows = 0, stringBytes = 0;
+        for (const ImportChunk& chunk : chunks) {
+            rows += chunk.rows[s].size();
+            for (const ImportRow& row : chunk.rows[s]) stringBytes += row.sku.size() + row.name.size();
+        }
+        shard.products.reserve(shard.products.rowCount() + rows, stringBytes);
+        shard.skuIndex.reserve(shard.products.size() + rows);
+        
+        for (const ImportChunk& chunk : chunks) {
+            for (const ImportRow& row : chunk.rows[s]) {
+                if (shard.skuIndex.findHashed(row.sku, row.hash) >= 0) continue;
+                shard.skuIndex.insertHashed(row.hash, shard.products.push(row.sku, row.name, row.quantity));
+                shard.products.trimToBudget();
+                imported[s]++;
+            }
+        }
+        
+        // Rebuilding the name and quantity indexes once is cheaper than millions of incremental inserts
+        if (imported[s] > 0) shard.nameIndexStale = shard.quantityIndexStale = true;
+        if (imported[s] > 0) shard.recountStock();
+    });
+    
+    size_t parsedRows = 0;
+    for (const ImportChunk& chunk : chunks) {
+        for (const auto& bucket : chunk.rows) parsedRows += bucket.size();
+    }
+    for (size_t count : imported) report.imported += count;
+    report.duplicates = parsedRows - report.imported;
+    
+    munmap(mapping, fileSize);
+    report.loadMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - loadStart).count();
+    return true;
+}
+
+// Function to insert a new product
+void insertProduct() {
+    string sku, name, quantityStr;
+    int quantity;
+    
+    cout << "Enter SKU: ";
+    getline(cin, sku);
+    
+    // Check for duplicate SKU
+    if (inventory.contains(sku)) {
+        cout << "Product with this SKU already exists!" << endl;
+        return;
+    }
+    
+    cout << "Enter Product Name: ";
+    getline(cin, name);
+    
+    // Validate: product name cannot be empty
+    if (name.empty()) {
+        cout << "Error: Product name cannot be empty." << endl;
+        return;
+    }
+    
+    cout << "Enter Quantity: ";
+    getline(cin, quantityStr);
+    
+    // Validate: quantity must be a number that fits an int
+    if (!parseNumber(quantityStr, quantity)) {
+        cout << "Invalid input. Quantity must be a number up to " << INT32_MAX << "." << endl;
+        return;
+    }
+    
+    // Validate: quantity must be positive
+    if (quantity < 0) {
+        cout << "Error: Quantity must be positive." << endl;
+        return;
+    }
+    
+    // Create product and add to inventory
+    uint64_t sequence = 0;
+    if (inventory.insert(sku, name, quantity, &sequence) == OP_DUPLICATE) {
+        cout << "Product with this SKU already exists!" << endl;
+        return;
+    }
+    commitMutation(sequence);
+    cout << "Product inserted successfully." << endl;
+}
+
+// Output formats of the inventory report writer
+enum ReportFormat { REPORT_TABLE, REPORT_CSV, REPORT_BINARY };
+
+// Binary export layout: magic | u32 version | u32 zero, then per product
+//   u16 SKU length | u16 name length | i32 quantity | i32 reserved | SKU | name
+// and finally u16 0xFFFF | u64 product count
+const char EXPORT_MAGIC[8] = {'I', 'N', 'V', 'E', 'X', 'P', '0', '1'};
+const uint32_t EXPORT_VERSION = 1;
+
+// Streams product rows to a file descriptor through a large buffer, with
+// hand-rolled fixed-width, CSV and binary formatting instead of iostream
+// manipulators, so a full catalog dump costs one write() per buffer
+class ReportWriter {
+private:
+    int fd;
+    ReportFormat format;
+    vector<char> buffer;
+    size_t used;
+    size_t bytes;
+    size_t rows;
+    bool failed;
+    
+    void put(const char* data, size_t size) {
+        if (used + size > buffer.size()) flush();
+        if (size > buffer.size()) buffer.resize(size);
+        memcpy(buffer.data() + used, data, size);
+        used += size;
+    }
+    
+    void put(string_view text) { put(text.data(), text.size()); }
+    
+    void putChars(char c, size_t count) {
+        if (used + count > buffer.size()) flush();
+        if (count > buffer.size()) buffer.resize(count);
+        memset(buffer.data() + used, c, count);
+        used += count;
+    }
+    
+    void putNumber(long long value) {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        put(digits, result.ptr - digits);
+    }
+    
+    template <class T>
+    void putRaw(T value) { put((const char*)&value, sizeof(value)); }
+    
+    // Left-aligned in a column of width (like setw + left: never truncates)
+    void putColumn(string_view text, size_t width) {
+        put(text);
+        if (text.size() < width) putChars(' ', width - text.size());
+    }
+    
+    // A CSV field, quoted only when it holds a delimiter, quote or line break
+    void putCsvField(string_view text) {
+        if (text.find_first_of(",\"\r\n") == string_view::npos) {
+            put(text);
+            return;
+        }
+        put("\"", 1);
+        for (char c : text) {
+            if (c == '"') put("\"\"", 2);
+            else put(&c, 1);
+        }
+        put("\"", 1);
+    }
+    
+public:
+    ReportWriter(int outputFd, ReportFormat outputFormat, size_t bufferSize = 4 << 20)
+        : fd(outputFd), format(outputFormat), buffer(bufferSize), used(0), bytes(0), rows(0), failed(false) {}
+    
+    // Header: the table title and column names, or the binary file header
+    void begin(string_view title) {
+        if (format == REPORT_TABLE) {
+            put("\n");
+            put(title);
+            put(":\n");
+            putColumn("SKU", 15);
+            putColumn("Product Name", 25);
+            putColumn("Quantity", 15);
+            put("\n-----------------------------------------------\n");
+        } else if (format == REPORT_BINARY) {
+            put(EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+            putRaw<uint32_t>(EXPORT_VERSION);
+            putRaw<uint32_t>(0);
+        }
+    }
+    
+    void row(const Product& item) {
+        if (format == REPORT_TABLE) {
+            putColumn(item.sku, 15);
+            putColumn(item.name, 25);
+            char digits[24];
+            auto result = to_chars(digits, digits + sizeof(digits), item.quantity);
+            putColumn(string_view(digits, result.ptr - digits), 15);
+            put("\n", 1);
+        } else if (format == REPORT_CSV) {
+            // sku,name,quantity: the same layout --import reads
+            putCsvField(item.sku);
+            put(",", 1);
+            putCsvField(item.name);
+            put(",", 1);
+            putNumber(item.quantity);
+            put("\n", 1);
+        } else {
+            // The row header has 16-bit lengths (0xFFFF SKU marks the trailer);
+            // a longer string fails the export rather than being cut short
+            if (item.sku.size() > 0xFFFE || item.name.size() > 0xFFFF) {
+                failed = true;
+                return;
+            }
+            uint16_t skuLength = item.sku.size(), nameLength = item.name.size();
+            putRaw(skuLength);
+            putRaw(nameLength);
+            putRaw<int32_t>(item.quantity);
+            putRaw<int32_t>(item.reserved);
+            put(item.sku.data(), skuLength);
+            put(item.name.data(), nameLength);
+        }
+        rows++;
+    }
+    
+    // Write the trailer and everything still buffered; false if any write failed
+    bool finish() {
+        if (format == REPORT_TABLE) {
+            put("\n", 1);
+        } else if (format == REPORT_BINARY) {
+            putRaw<uint16_t>(0xFFFF);
+            putRaw<uint64_t>(rows);
+        }
+        flush();
+        return !failed;
+    }
+    
+    void flush() {
+        size_t written = 0;
+        while (written < used && !failed) {
+            ssize_t n = write(fd, buffer.data() + written, used - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) failed = true;
+            else written += n;
+        }
+        bytes += written;
+        used = 0;
+    }
+    
+    size_t rowCount() const { return rows; }
+    size_t byteCount() const { return bytes; }
+};
+
+// Outcome of writing an inventory report
+struct ReportStats {
+    size_t rows;
+    size_t bytes;
+    double ms;
+    bool ok;
+};
+
+// Stream products [offset, offset + limit) of a point-in-time view to fd
+ReportStats writeReport(int fd, ReportFormat format, size_t offset, size_t limit) {
+    auto start = chrono::high_resolution_clock::now();
+    ReportWriter out(fd, format);
+    out.begin("Current Inventory");
+    size_t position = 0;
+    bool complete = inventory.forEachAt([&](const Product& item) {
+        if (position++ < offset || out.rowCount() >= limit) return;
+        out.row(item);
+    });
+    bool ok = out.finish() && complete;
+    double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    return ReportStats{out.rowCount(), out.byteCount(), ms, ok};
+}
+
+// Function to display all products in inventory
+void displayInventory() {
+    if (inventory.empty()) {
+        cout << "Inventory is empty." << endl;
+        return;
+    }
+    
+    // Streamed from a point-in-time view through the report buffer, so
+    // writers are never held up by the terminal
+    cout.flush();
+    writeReport(STDOUT_FILENO, REPORT_TABLE, 0, SIZE_MAX);
+}
+
+// Function to show operation counts and latency percentiles as a table or JSON
+void displayMetrics() {
+    string format;
+    cout << "Format (T = table, J = JSON): ";
+    getline(cin, format);
+    if (format == "T" || format == "t") {
+        cout << "\nOperation Latency (microseconds):" << endl;
+        metrics.writeText(cout);
+    } else if (format == "J" || format == "j") {
+        metrics.writeJson(cout, true);
+        cout << endl;
+    } else {
+        cout << "Invalid format. Use T or J." << endl;
+    }
+}
+
+// Function to export the inventory, or one page of it, as a table, CSV or binary file
+void exportInventory() {
+    string formatText, path, offsetText, limitText;
+    cout << "Format (T = table, C = CSV, B = binary): ";
+    getline(cin, formatText);
+    ReportFormat format;
+    if (formatText == "T" || formatText == "t") format = REPORT_TABLE;
+    else if (formatText == "C" || formatText == "c") format = REPORT_CSV;
+    else if (formatText == "B" || formatText == "b") format = REPORT_BINARY;
+    else {
+        cout << "Invalid format. Use T, C or B." << endl;
+        return;
+    }
+    
+    cout << "Output file (Enter for screen): ";
+    getline(cin, path);
+    if (path.empty() && format == REPORT_BINARY) {
+        cout << "Error: Binary exports need an output file." << endl;
+        return;
+    }
+    cout << "Skip first N products (Enter for 0): ";
+    getline(cin, offsetText);
+    cout << "Max products (Enter for all): ";
+    getline(cin, limitText);
+    size_t offset = 0, limit = SIZE_MAX;
+    if ((!offsetText.empty() && !parseNumber(offsetText, offset)) || (!limitText.empty() && !parseNumber(limitText, limit))) {
+        cout << "Invalid input. Offset and limit must be numbers." << endl;
+        return;
+    }
+    
+    int fd = STDOUT_FILENO;
+    if (!path.empty()) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cout << "Error: Could not open " << path << "." << endl;
+            return;
+        }
+    }
+    cout.flush();
+    ReportStats stats = writeReport(fd, format, offset, limit);
+    if (fd != STDOUT_FILENO) close(fd);
+    
+    if (!stats.ok) {
+        cout << "Error: Export was not fully written (a write failed, or a SKU or name is too long for the binary format)."
+             << endl;
+        return;
+    }
+    cout << "Exported " << stats.rows << " products (" << stats.bytes << " bytes) in " << fixed << setprecision(3)
+         << stats.ms << " ms";
+    if (stats.ms > 0) cout << " (" << stats.bytes / stats.ms / 1000 << " MB/s)";
+    cout << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Function to search product by SKU
+void searchBySKU() {
+    string sku;
+    cout << "Enter SKU to search: ";
+    getline(cin, sku);
+    
+    Product item;
+    if (!inventory.find(sku, item)) {
+        cout << "Product with SKU " << sku << " not found." << endl;
+        return;
+    }
+    
+    cout << "\nProduct Found:" << endl;
+    cout << "SKU: " << item.sku << endl;
+    cout << "Name: " << item.name << endl;
+    cout << "Quantity: " << item.quantity << endl;
+    if (item.reserved > 0) {
+        cout << "Reserved: " << item.reserved << " (available: " << item.quantity - item.reserved << ")" << endl;
+    }
+}
+
+// Print the products for one group of name search results
+void printNameMatches(const string& label, const vector<Product>& items) {
+    if (items.empty()) return;
+    cout << "\n" << label << ":" << endl;
+    for (const Product& item : items) {
+        cout << "SKU: " << item.sku << ", Name: " << item.name 
+             << ", Quantity: " << item.quantity << endl;
+    }
+}
+
+// Function to search product by Name (exact name, name prefix or words)
+void searchByName() {
+    string name;
+    cout << "Enter Product Name, prefix or words to search: ";
+    getline(cin, name);
+    
+    if (name.empty()) {
+        cout << "Error: Search text cannot be empty." << endl;
+        return;
+    }
+    
+    NameSearchResult matches = inventory.searchByName(name);
+    if (matches.exact.empty() && matches.prefix.empty() && matches.words.empty()) {
+        // Nothing matched as typed: offer names a few typos away
+        vector<FuzzyProduct> close = inventory.fuzzySearchByName(name);
+        if (close.empty()) {
+            cout << "Product with name " << name << " not found." << endl;
+            return;
+        }
+        cout << "\nNo exact match. Did you mean:" << endl;
+        for (const FuzzyProduct& match : close) {
+            cout << "SKU: " << match.product.sku << ", Name: " << match.product.name
+                 << ", Quantity: " << match.product.quantity << " (" << match.distance
+                 << (match.distance == 1 ? " edit" : " edits") << " away)" << endl;
+        }
+        return;
+    }
+    
+    printNameMatches("Products Found", matches.exact);
+    printNameMatches("Names Starting With \"" + name + "\"", matches.prefix);
+    printNameMatches("Names Containing The Words", matches.words);
+    if (matches.truncated) {
+        cout << "(showing first " << MAX_NAME_RESULTS << " matches, refine the search for more)" << endl;
+    }
+}
+
+// Function to update quantity of existing product
+void updateQuantity() {
+    string sku, quantityStr;
+    int newQuantity;
+    
+    cout << "Enter SKU to update: ";
+    getline(cin, sku);
+    
+    Product item;
+    if (!inventory.find(sku, item)) {
+        cout << "Product with SKU " << sku << " not found." << endl;
+        return;
+    }
+    
+    cout << "Current Quantity: " << item.quantity << endl;
+    cout << "Enter new Quantity: ";
+    getline(cin, quantityStr);
+    
+    if (!parseNumber(quantityStr, newQuantity)) {
+        cout << "Invalid input. Quantity must be a number up to " << INT32_MAX << "." << endl;
+        return;
+    }
+    
+    if (newQuantity < 0) {
+        cout << "Error: Quantity must be positive." << endl;
+        return;
+    }
+    
+    uint64_t sequence = 0;
+    OpStatus status = inventory.update(sku, newQuantity, &sequence);
+    if (status == OP_NOT_FOUND) {
+        cout << "Product with SKU " << sku << " not found." << endl;
+        return;
+    }
+    if (status == OP_INSUFFICIENT) {
+        cout << "Error: Quantity cannot be below the " << item.reserved << " units currently reserved." << endl;
+        return;
+    }
+    commitMutation(sequence);
+    cout << "Quantity updated successfully." << endl;
+}
+
+// Function to delete product by SKU
+void deleteProduct() {
+    string sku;
+    cout << "Enter SKU to delete: ";
+    getline(cin, sku);
+    
+    string name;
+    uint64_t sequence = 0;
+    if (inventory.erase(sku, &name, &sequence) == OP_NOT_FOUND) {
+        cout << "Product with SKU " << sku << " not found." << endl;
+        return;
+    }
+    
+    commitMutation(sequence);
+    cout << "Product " << name << " removed from inventory." << endl;
+}
+
+// Function to reserve, commit or release stock for an order
+void manageReservation() {
+    string sku, action, unitsStr;
+    cout << "Enter SKU: ";
+    getline(cin, sku);
+    
+    Product item;
+    if (!inventory.find(sku, item)) {
+        cout << "Product with SKU " << sku << " not found." << endl;
+        return;
+    }
+    cout << "On Hand: " << item.quantity << ", Reserved: " << item.reserved
+         << ", Available: " << item.quantity - item.reserved << endl;
+    
+    cout << "Action (R = reserve, C = commit reserved, X = release reserved): ";
+    getline(cin, action);
+    cout << "Enter Units: ";
+    getline(cin, unitsStr);
+    
+    int units;
+    if (!parseNumber(unitsStr, units, 1)) {
+        cout << "Invalid input. Units must be a positive number up to " << INT32_MAX << "." << endl;
+        return;
+    }
+    
+    OpStatus status;
+    uint64_t sequence = 0;
+    if (action == "R" || action == "r") {
+        status = inventory.reserve(sku, units);
+    } else if (action == "C" || action == "c") {
+        status = inventory.commitReserved(sku, units, &sequence);
+    } else if (action == "X" || action == "x") {
+        status = inventory.release(sku, units);
+    } else {
+        cout << "Invalid action. Use R, C or X." << endl;
+        return;
+    }
+    
+    if (status == OP_NOT_FOUND) {
+        cout << "Product with SKU " << sku << " not found." << endl;
+    } else if (status == OP_INSUFFICIENT) {
+        cout << "Error: Not enough " << (action == "R" || action == "r" ? "available" : "reserved") << " units." << endl;
+    } else {
+        commitMutation(sequence);
+        cout << "Stock " << (action == "R" || action == "r" ? "reserved" : action == "C" || action == "c" ? "committed" : "released")
+             << " successfully." << endl;
+    }
+}
+
+// Most rows a stock report prints
+const size_t MAX_REPORT_ROWS = 100;
+
+// Function to list low-stock products from the quantity index: below a
+// reorder threshold, within a quantity range, or the N lowest
+void stockReport() {
+    string kind, first, second;
+    cout << "Report (B = below threshold, R = quantity range, L = lowest N, H = highest N, T = totals): ";
+    getline(cin, kind);
+    
+    vector<Product> rows;
+    string title;
+    if (kind == "B" || kind == "b") {
+        cout << "Enter Reorder Threshold: ";
+        getline(cin, first);
+        int threshold;
+        if (!parseNumber(first, threshold, 0)) {
+            cout << "Invalid input. Threshold must be a non-negative number." << endl;
+            return;
+        }
+        rows = inventory.belowQuantity(threshold, MAX_REPORT_ROWS + 1);
+        title = "Products With Quantity Below " + first;
+    } else if (kind == "R" || kind == "r") {
+        cout << "Enter Lowest Quantity: ";
+        getline(cin, first);
+        cout << "Enter Highest Quantity: ";
+        getline(cin, second);
+        int low, high;
+        if (!parseNumber(first, low, 0) || !parseNumber(second, high, low)) {
+            cout << "Invalid input. Enter two non-negative numbers, lowest first." << endl;
+            return;
+        }
+        rows = inventory.quantityRange(low, high, MAX_REPORT_ROWS + 1);
+        title = "Products With Quantity " + first + " to " + second;
+    } else if (kind == "L" || kind == "l") {
+        cout << "How many products: ";
+        getline(cin, first);
+        size_t count;
+        if (!parseNumber(first, count, size_t(1))) {
+            cout << "Invalid input. Enter a positive number." << endl;
+            return;
+        }
+        count = min(count, MAX_REPORT_ROWS);
+        rows = inventory.lowestStock(count);
+        title = "Lowest " + to_string(count) + " Stock Levels";
+    } else if (kind == "H" || kind == "h") {
+        cout << "How many products: ";
+        getline(cin, first);
+        size_t count;
+        if (!parseNumber(first, count, size_t(1))) {
+            cout << "Invalid input. Enter a positive number." << endl;
+            return;
+        }
+        count = min(count, MAX_REPORT_ROWS);
+        rows = inventory.highestStock(count);
+        title = "Highest " + to_string(count) + " Stock Levels";
+    } else if (kind == "T" || kind == "t") {
+        StockAggregates totals = inventory.aggregates();
+        cout << "\nStock Totals:" << endl;
+        cout << "Products: " << totals.products << endl;
+        cout << "Units on hand: " << totals.unitsOnHand << endl;
+        cout << "Out of stock: " << totals.outOfStock << endl;
+        return;
+    } else {
+        cout << "Invalid report type. Use B, R, L, H or T." << endl;
+        return;
+    }
+    
+    bool truncated = rows.size() > MAX_REPORT_ROWS;
+    if (truncated) rows.resize(MAX_REPORT_ROWS);
+    cout << "\n" << title << ":" << endl;
+    if (rows.empty()) {
+        cout << "No products found." << endl;
+        return;
+    }
+    cout << setw(15) << left << "SKU" 
+         << setw(25) << left << "Product Name" 
+         << setw(15) << left << "Quantity" << endl;
+    cout << "-----------------------------------------------" << endl;
+    for (const Product& item : rows) {
+        cout << setw(15) << left << item.sku 
+             << setw(25) << left << item.name 
+             << setw(15) << left << item.quantity << endl;
+    }
+    if (truncated) cout << "(showing the first " << MAX_REPORT_ROWS << " products)" << endl;
+}
+
+// Print how much of the product storage is tombstones and dead string bytes
+void displayFragmentation() {
+    size_t rows, tombstones, arenaBytes, deadBytes;
+    inventory.fragmentation(rows, tombstones, arenaBytes, deadBytes);
+    cout << "Tombstones: " << tombstones << " of " << rows << " rows ("
+         << (rows > 0 ? 100.0 * tombstones / rows : 0.0) << "% fragmented), "
+         << deadBytes << " of " << arenaBytes << " string bytes dead" << endl;
+}
+
+// Function to display SKU index statistics
+void displayIndexStats() {
+    IndexStats s = inventory.indexStats();
+    cout << "\nSKU Index Statistics (" << inventory.shardCount() << " shards):" << endl;
+    cout << "Entries: " << s.entries << endl;
+    cout << "Capacity: " << s.capacity << endl;
+    cout << "Load Factor: " << fixed << setprecision(3) << s.loadFactor << endl;
+    cout << "Average Probe Length: " << s.averageProbeLength << endl;
+    cout << "Max Probe Length: " << s.maxProbeLength << endl;
+    cout << "Bloom Filter: " << s.filterBytes << " bytes, " << s.filterRejects << " misses answered by the filter";
+    if (s.filterRejects + s.filterFalsePositives > 0) {
+        cout << ", false-positive rate " << 100.0 * s.filterFalsePositives / (s.filterRejects + s.filterFalsePositives) << "%";
+    }
+    cout << endl;
+    size_t names, words, trigrams;
+    inventory.nameIndexSizes(names, words, trigrams);
+    cout << "\nName Index: " << names << " distinct names, " << words << " distinct words, "
+         << trigrams << " trigram lists" << endl;
+    
+    size_t storageBytes, stringBytes;
+    inventory.storageSizes(storageBytes, stringBytes);
+    cout << "\nProduct Storage: " << storageBytes << " bytes (" << stringBytes << " string bytes";
+    if (s.entries > 0) cout << ", " << (double)storageBytes / s.entries << " bytes per product";
+    cout << ")" << endl;
+    long long onHand, reserved;
+    inventory.stockTotals(onHand, reserved);
+    cout << "Units: " << onHand << " on hand, " << reserved << " reserved" << endl;
+    displayFragmentation();
+    size_t views, undoEntries;
+    inventory.viewStats(views, undoEntries);
+    cout << "Read Views: " << views << " open, " << undoEntries << " undo entries retained" << endl;
+    CompactionStats c = inventory.compactionStats();
+    cout << "Compaction: " << c.passes << " shard passes, " << c.rowsReclaimed << " rows reclaimed, "
+         << c.totalMs << " ms total, longest pause " << c.maxPauseMs << " ms" << endl;
+    FeedStats f = changeFeed.stats();
+    cout << "Change Feed: " << f.published << " events published, " << f.retained << " of " << f.capacity
+         << " retained, " << f.overruns << " subscriber overruns (" << f.missed << " events missed)" << endl;
+    PagingStats p = inventory.pagingStats();
+    if (p.enabled) {
+        cout << "Paging: " << p.residentBytes << " of " << p.budgetBytes << " budgeted bytes resident, "
+             << p.pagedNames << " names paged out (" << p.pagedBytes << " bytes), " << p.hits << " hits, "
+             << p.misses << " misses";
+        if (p.hits + p.misses > 0) cout << " (" << 100.0 * p.hits / (p.hits + p.misses) << "% hit rate)";
+        cout << ", " << p.evictions << " evictions, page file " << p.pageFileBytes << " bytes";
+        if (p.readErrors > 0) cout << ", " << p.readErrors << " read errors";
+        cout << endl;
+    }
+    if (replicationLeader.running()) {
+        ReplicationStats r = replicationLeader.stats();
+        cout << "Replication: leader at #" << r.sequence << ", " << r.followers << " followers (furthest "
+             << r.lagRecords << " records behind), " << r.snapshots << " snapshots and " << r.bytes << " bytes sent, "
+             << replicationLog.retainedBytes() << " log bytes retained" << endl;
+    } else if (replica.running()) {
+        ReplicationStats r = replica.stats();
+        cout << "Replication: follower " << (r.connected ? "connected" : "disconnected") << ", applied #" << r.sequence
+             << ", " << r.lagRecords << " records behind, lag " << r.lagMs << " ms (average " << r.averageLagMs
+             << ", max " << r.maxLagMs << "), " << r.snapshots << " snapshots installed, " << r.bytes << " bytes received" << endl;
+    }
+
+    JournalStats j = journal.stats();
+    cout << "\nJournal: " << j.records << " records in " << j.groupCommits << " group commits";
+    if (j.groupCommits > 0) cout << " (" << (double)j.records / j.groupCommits << " per sync)";
+    cout << ", " << j.bytesWritten << " bytes, durable up to #" << j.durableSequence << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Function to compact every shard now and report what it reclaimed
+void compactStorage() {
+    cout << fixed << setprecision(3);
+    cout << "\nBefore: ";
+    displayFragmentation();
+    CompactionStats pass = inventory.compact();
+    cout << "After:  ";
+    displayFragmentation();
+    cout << "Compacted " << pass.passes << " shards: " << pass.rowsReclaimed << " rows and "
+         << pass.bytesReclaimed << " string bytes reclaimed in " << pass.totalMs
+         << " ms (longest shard pause " << pass.maxPauseMs << " ms)" << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Function to save the inventory snapshot and trim the journal it covers;
+// false if the snapshot could not be written
+bool saveInventory() {
+    // On a replica, save between applied batches so the snapshot matches the journal
+    lock_guard<mutex> pause(replica.applyLock());
+    auto start = chrono::high_resolution_clock::now();
+    uint64_t covered = 0;
+    if (!saveSnapshot(snapshotPath, covered)) {
+        cout << "Error: Could not write snapshot " << snapshotPath << "." << endl;
+        return false;
+    }
+    if (!journal.checkpoint(covered)) {
+        cout << "Warning: could not truncate journal " << journalPath << "." << endl;
+    }
+    auto end = chrono::high_resolution_clock::now();
+    cout << "Saved " << inventory.size() << " products to " << snapshotPath << " in "
+         << fixed << setprecision(3) << chrono::duration<double, milli>(end - start).count() << " ms" << endl;
+    cout.unsetf(ios::fixed);
+    return true;
+}
+
+// Buffered line reader over a file descriptor for batch mode
+class BatchReader {
+private:
+    int fd;
+    vector<char> buffer;
+    size_t start;
+    size_t end;
+    bool eof;
+    
+public:
+    BatchReader(int inputFd) : fd(inputFd), buffer(1 << 20), start(0), end(0), eof(false) {}
+    
+    // True when the next line is not yet in the buffer and reading it may block
+    bool needsRead() const {
+        return memchr(buffer.data() + start, '\n', end - start) == nullptr && !eof;
+    }
+    
+    // Next line without its newline; false at end of input
+    bool next(string_view& line) {
+        while (true) {
+            const char* begin = buffer.data() + start;
+            const char* nl = (const char*)memchr(begin, '\n', end - start);
+            if (nl) {
+                line = string_view(begin, nl - begin);
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                start = nl - buffer.data() + 1;
+                return true;
+            }
+            if (eof) {
+                if (start == end) return false;
+                line = string_view(begin, end - start);
+                start = end;
+                return true;
+            }
+            
+            // Move the partial line to the front, growing for very long lines
+            memmove(buffer.data(), begin, end - start);
+            end -= start;
+            start = 0;
+            if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+            ssize_t n = read(fd, buffer.data() + end, buffer.size() - end);
+            if (n <= 0) eof = true;
+            else end += n;
+        }
+    }
+};
+
+// Buffered response writer for batch mode
+class BatchWriter {
+private:
+    int fd;
+    string buffer;
+    
+public:
+    BatchWriter(int outputFd) : fd(outputFd) { buffer.reserve(1 << 20); }
+    
+    BatchWriter& operator<<(string_view text) {
+        buffer.append(text.data(), text.size());
+        return *this;
+    }
+    
+    BatchWriter& operator<<(char c) {
+        buffer.push_back(c);
+        return *this;
+    }
+    
+    BatchWriter& operator<<(long long value) {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        buffer.append(digits, result.ptr - digits);
+        return *this;
+    }
+    
+    bool full() const { return buffer.size() >= (1 << 20) - 4096; }
+    
+    void flush() {
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+            if (n <= 0) break;
+            written += n;
+        }
+        buffer.clear();
+    }
+};
+
+// Split off the next space/tab separated word of line
+string_view nextWord(string_view& line) {
+    size_t begin = line.find_first_not_of(" \t");
+    if (begin == string_view::npos) {
+        line = string_view();
+        return string_view();
+    }
+    size_t stop = line.find_first_of(" \t", begin);
+    if (stop == string_view::npos) stop = line.size();
+    string_view word = line.substr(begin, stop - begin);
+    line.remove_prefix(stop);
+    return word;
+}
+
+// Write one product as "sku<TAB>name<TAB>quantity"
+void writeProduct(BatchWriter& out, const Product& item) {
+    out << item.sku << '\t' << item.name << '\t' << (long long)item.quantity << '\n';
+}
+
+// Non-interactive command loop: one command per line, one compact response
+// per command, no prompts or menu. Commands:
+//   I <sku> <quantity> <name...>   insert            -> OK | ERR duplicate | ERR invalid
+//   S <sku>                        search by SKU     -> sku<TAB>name<TAB>quantity | NF
+//   N <name, prefix or words>      search by name    -> <count> then one product per line
+//   F <name with typos>            fuzzy name search -> <count> then one product per line, closest first
+//   U <sku> <quantity>             update quantity   -> OK | NF | ERR invalid
+//   D <sku>                        delete            -> OK | NF
+//   R <sku> <units>                reserve stock     -> OK | NF | ERR insufficient | ERR invalid
+//   C <sku> <units>                commit reserved   -> OK | NF | ERR insufficient | ERR invalid
+//   X <sku> <units>                release reserved  -> OK | NF | ERR insufficient | ERR invalid
+//   L                              list inventory    -> <count> then one product per line | ERR read
+//   BELOW <threshold> [limit]      quantity < x      -> <count> then one product per line, lowest first
+//   RANGE <low> <high> [limit]     quantity in range -> <count> then one product per line, lowest first
+//   LOWEST <n>                     n lowest stocked  -> <count> then one product per line, lowest first
+//   HIGHEST <n>                    n highest stocked -> <count> then one product per line, highest first
+//   TOTALS                         stock totals      -> OK <products> <units on hand> <out of stock>
+//   TXN <sku> <delta> [<sku> <delta> ...]
+//                                  atomic transaction -> OK <lines> | NF <line> | ERR insufficient <line> | ERR invalid
+//   METRICS [FULL]                 operation metrics -> one line of JSON
+//   PAGING                         paging counters   -> OK <hits> <misses> <evictions> <names paged out> <resident bytes>
+//   REPLICATION                    replication state -> OK leader <sequence> <followers> <most records behind>
+//                                                       | OK follower <applied> <records behind> <lag us> | OK none
+//   COMPACT                        drop tombstones   -> OK <rows reclaimed> <bytes reclaimed>
+//   SAVE                           snapshot          -> OK | ERR save
+//   Q                              quit
+// Responses are buffered and written when the input runs dry or the buffer
+// fills. Mutations are journaled without waiting; the journal is synced once
+// before each flush so every acknowledged change is durable. A replica
+// (--follow) answers ERR replica to I, U, D, R, C, X and TXN.
+void runBatch(int inputFd, int outputFd) {
+    BatchReader in(inputFd);
+    BatchWriter out(outputFd);
+    uint64_t lastSequence = 0;
+    
+    auto flushResponses = [&] {
+        if (lastSequence != 0 && !journal.waitDurable(lastSequence)) {
+            out << "ERR journal\n";
+        }
+        out.flush();
+    };
+    
+    string_view line;
+    Product item;
+    while (true) {
+        if (in.needsRead() || out.full()) flushResponses();
+        if (!in.next(line)) break;
+        
+        string_view command = nextWord(line);
+        if (command.empty()) continue;
+        
+        // A replica only changes through its leader
+        if (replica.running() && (command == "I" || command == "U" || command == "D" || command == "R" ||
+                                  command == "C" || command == "X" || command == "TXN")) {
+            out << "ERR replica\n";
+            continue;
+        }
+        
+        if (command == "I") {
+            string_view sku = nextWord(line);
+            string_view quantityText = nextWord(line);
+            size_t nameStart = line.find_first_not_of(" \t");
+            string_view name = nameStart == string_view::npos ? string_view() : line.substr(nameStart);
+            int quantity;
+            if (sku.empty() || name.empty() || !parseNumber(quantityText, quantity, 0)) {
+                out << "ERR invalid\n";
+            } else if (inventory.insert(string(sku), string(name), quantity, &lastSequence) == OP_DUPLICATE) {
+                out << "ERR duplicate\n";
+            } else {
+                out << "OK\n";
+            }
+        } else if (command == "S") {
+            if (inventory.find(nextWord(line), item)) writeProduct(out, item);
+            else out << "NF\n";
+        } else if (command == "N") {
+            size_t queryStart = line.find_first_not_of(" \t");
+            string query = queryStart == string_view::npos ? string() : string(line.substr(queryStart));
+            NameSearchResult matches = inventory.searchByName(query);
+            out << (long long)(matches.exact.size() + matches.prefix.size() + matches.words.size()) << '\n';
+            for (const vector<Product>* group : {&matches.exact, &matches.prefix, &matches.words}) {
+                for (const Product& match : *group) writeProduct(out, match);
+            }
+        } else if (command == "F") {
+            size_t queryStart = line.find_first_not_of(" \t");
+            string query = queryStart == string_view::npos ? string() : string(line.substr(queryStart));
+            vector<FuzzyProduct> matches = inventory.fuzzySearchByName(query);
+            out << (long long)matches.size() << '\n';
+            for (const FuzzyProduct& match : matches) writeProduct(out, match.product);
+        } else if (command == "U") {
+            string sku(nextWord(line));
+            int quantity;
+            if (!parseNumber(nextWord(line), quantity, 0)) {
+                out << "ERR invalid\n";
+            } else {
+                OpStatus status = inventory.update(sku, quantity, &lastSequence);
+                out << (status == OP_OK ? "OK\n" : status == OP_NOT_FOUND ? "NF\n" : "ERR insufficient\n");
+            }
+        } else if (command == "D") {
+            string sku(nextWord(line));
+            if (inventory.erase(sku, nullptr, &lastSequence) == OP_NOT_FOUND) {
+                out << "NF\n";
+            } else {
+                out << "OK\n";
+            }
+        } else if (command == "R" || command == "C" || command == "X") {
+            string sku(nextWord(line));
+            int units;
+            if (!parseNumber(nextWord(line), units, 0) || units == 0) {
+                out << "ERR invalid\n";
+                continue;
+            }
+            OpStatus status;
+            if (command == "R") status = inventory.reserve(sku, units);
+            else if (command == "C") status = inventory.commitReserved(sku, units, &lastSequence);
+            else status = inventory.release(sku, units);
+            out << (status == OP_OK ? "OK\n" : status == OP_NOT_FOUND ? "NF\n" : "ERR insufficient\n");
+        } else if (command == "L") {
+            // Collect a point-in-time view first so the count matches the rows
+            vector<Product> all;
+            if (!inventory.forEachAt([&](const Product& item) { all.push_back(item); })) {
+                out << "ERR read\n";
+            } else {
+                out << (long long)all.size() << '\n';
+                for (const Product& p : all) {
+                    writeProduct(out, p);
+                    if (out.full()) flushResponses();
+                }
+            }
+        } else if (command == "BELOW" || command == "RANGE" || command == "LOWEST") {
+            // A missing limit means every matching product
+            int low = 0, high = 0, limit = INT32_MAX;
+            bool valid;
+            if (command == "BELOW") {
+                valid = parseNumber(nextWord(line), high, 0);
+                high--;
+            } else if (command == "RANGE") {
+                valid = parseNumber(nextWord(line), low, 0) && parseNumber(nextWord(line), high, 0);
+            } else {
+                valid = parseNumber(nextWord(line), limit, 0);
+                high = INT32_MAX;
+            }
+            string_view limitText = nextWord(line);
+            if (!limitText.empty() && command != "LOWEST") valid = valid && parseNumber(limitText, limit, 0);
+            if (!valid) {
+                out << "ERR invalid\n";
+            } else {
+                vector<Product> rows = low <= high ? inventory.quantityRange(low, high, limit) : vector<Product>();
+                out << (long long)rows.size() << '\n';
+                for (const Product& p : rows) {
+                    writeProduct(out, p);
+                    if (out.full()) flushResponses();
+                }
+            }
+        } else if (command == "HIGHEST") {
+            int limit;
+            if (!parseNumber(nextWord(line), limit, 0)) {
+                out << "ERR invalid\n";
+            } else {
+                vector<Product> rows = inventory.highestStock(limit);
+                out << (long long)rows.size() << '\n';
+                for (const Product& p : rows) {
+                    writeProduct(out, p);
+                    if (out.full()) flushResponses();
+                }
+            }
+        } else if (command == "TXN") {
+            // Lines are numbered from 1 in the response
+            vector<TransactionLine> lines;
+            bool valid = true;
+            for (string_view sku = nextWord(line); valid && !sku.empty(); sku = nextWord(line)) {
+                int delta;
+                valid = parseNumber(nextWord(line), delta);
+                lines.push_back(TransactionLine{string(sku), delta});
+            }
+            size_t failed = 0;
+            OpStatus status = valid && !lines.empty() ? inventory.applyTransaction(lines, &failed, &lastSequence) : OP_OK;
+            if (!valid || lines.empty()) out << "ERR invalid\n";
+            else if (status == OP_OK) out << "OK " << (long long)lines.size() << '\n';
+            else if (status == OP_NOT_FOUND) out << "NF " << (long long)(failed + 1) << '\n';
+            else out << "ERR insufficient " << (long long)(failed + 1) << '\n';
+        } else if (command == "TOTALS") {
+            StockAggregates totals = inventory.aggregates();
+            out << "OK " << (long long)totals.products << ' ' << totals.unitsOnHand << ' ' << (long long)totals.outOfStock << '\n';
+        } else if (command == "METRICS") {
+            // One line of JSON; METRICS FULL adds the histogram buckets
+            ostringstream json;
+            metrics.writeJson(json, nextWord(line) == "FULL");
+            out << string_view(json.str()) << '\n';
+        } else if (command == "PAGING") {
+            PagingStats p = inventory.pagingStats();
+            out << "OK " << (long long)p.hits << ' ' << (long long)p.misses << ' ' << (long long)p.evictions << ' '
+                << (long long)p.pagedNames << ' ' << (long long)p.residentBytes << '\n';
+        } else if (command == "REPLICATION") {
+            if (replicationLeader.running()) {
+                ReplicationStats r = replicationLeader.stats();
+                out << "OK leader " << (long long)r.sequence << ' ' << (long long)r.followers << ' '
+                    << (long long)r.lagRecords << '\n';
+            } else if (replica.running()) {
+                ReplicationStats r = replica.stats();
+                out << "OK follower " << (long long)r.sequence << ' ' << (long long)r.lagRecords << ' '
+                    << (long long)(r.lagMs * 1000) << '\n';
+            } else {
+                out << "OK none\n";
+            }
+        } else if (command == "COMPACT") {
+            CompactionStats pass = inventory.compact();
+            out << "OK " << (long long)pass.rowsReclaimed << ' ' << (long long)pass.bytesReclaimed << '\n';
+        } else if (command == "SAVE") {
+            flushResponses();
+            uint64_t covered = 0;
+            lock_guard<mutex> pause(replica.applyLock());
+            bool saved = saveSnapshot(snapshotPath, covered) && journal.checkpoint(covered);
+            out << (saved ? "OK\n" : "ERR save\n");
+        } else if (command == "Q") {
+            break;
+        } else {
+            out << "ERR command\n";
+        }
+    }
+    flushResponses();
+}
+
+// Check point-in-time views against writers: one thread keeps sweeping
+// quantity k over every product in order, so any consistent view sees a
+// run of k followed by a run of k - 1. Reports writer throughput with and
+// without a reader scanning, and how often each kind of scan was torn.
+void runSnapshotBenchmark(size_t productCount) {
+    const double phaseSeconds = 1.5;
+    
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Point-in-Time Read Benchmark (" << productCount << " products, 1 writer sweeping updates)" << endl;
+    cout << string(70, '=') << endl;
+    
+    ShardedInventory store;
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) {
+        skus[i] = "MV" + to_string(i);
+        store.insert(skus[i], "Sweep item", 0);
+    }
+    
+    atomic<bool> stop(false);
+    atomic<size_t> updates(0);
+    thread writer([&] {
+        for (int k = 1; !stop; k++) {
+            for (size_t i = 0; i < productCount && !stop; i++) {
+                store.update(skus[i], k);
+                updates.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    });
+    
+    // A scan is consistent if quantities never rise along the sweep order and span at most 1
+    vector<int> seen(productCount);
+    auto record = [&](const string& sku, int quantity) {
+        size_t index = 0;
+        from_chars(sku.data() + 2, sku.data() + sku.size(), index);
+        seen[index] = quantity;
+    };
+    auto consistent = [&] {
+        for (size_t i = 1; i < productCount; i++) {
+            if (seen[i] > seen[i - 1]) return false;
+        }
+        return seen[0] - seen[productCount - 1] <= 1;
+    };
+    
+    // Runs scan repeatedly for one phase; returns writer updates per second
+    auto phase = [&](const char* label, int mode) {
+        size_t scans = 0, torn = 0;
+        double scanMs = 0;
+        size_t before = updates.load();
+        auto start = chrono::high_resolution_clock::now();
+        while (chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() < phaseSeconds) {
+            if (mode == 0) {
+                this_thread::sleep_for(chrono::milliseconds(10));
+                continue;
+            }
+            auto scanStart = chrono::high_resolution_clock::now();
+            if (mode == 1) {
+                store.forEachAt([&](const Product& item) { record(item.sku, item.quantity); });
+            } else {
+                store.forEach([&](const ProductTable& products, size_t i) {
+                    record(string(products.sku(i)), products.stock(i).onHand());
+                });
+            }
+            scanMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - scanStart).count();
+            scans++;
+            if (!consistent()) torn++;
+        }
+        double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        double rate = (updates.load() - before) / seconds / 1e6;
+        cout << setw(28) << left << label << setw(16) << left << rate;
+        if (mode == 0) cout << "-" << endl;
+        else cout << scans << " scans, " << scanMs / scans << " ms each, " << torn << " torn" << endl;
+        return torn;
+    };
+    
+    cout << fixed << setprecision(2);
+    cout << setw(28) << left << "Reader" << setw(16) << left << "Writer (M/s)" << "Scans" << endl;
+    cout << string(70, '-') << endl;
+    phase("none", 0);
+    size_t tornViews = phase("point-in-time view", 1);
+    phase("per-shard locked scan", 2);
+    stop = true;
+    writer.join();
+    
+    size_t views, undoEntries;
+    store.viewStats(views, undoEntries);
+    cout << "Views left open: " << views << ", undo entries retained: " << undoEntries << endl;
+    cout << "Consistency check: " << (tornViews == 0 && views == 0 ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Export the catalog as binary and CSV and report throughput, then import
+// the CSV back and check every row survives it, including names holding
+// quotes, commas and line breaks. Uses the global store, left empty after.
+void runExportBenchmark(size_t productCount) {
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Report Export Benchmark (" << productCount << " products)" << endl;
+    cout << string(70, '=') << endl;
+    
+    auto skuOf = [](size_t i) { return "EX" + to_string(i); };
+    auto nameOf = [](size_t i) {
+        return i % 7 == 0 ? "Bolt 3/8\" x " + to_string(i) + "\", zinc\nbox of 50" : "Export item " + to_string(i);
+    };
+    for (size_t i = 0; i < productCount; i++) inventory.insert(skuOf(i), nameOf(i), i % 1000);
+    
+    char path[] = "/tmp/inventory-export-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        cout << "Error: could not create a scratch export file." << endl;
+        return;
+    }
+    
+    bool written = true;
+    cout << fixed << setprecision(1);
+    cout << setw(10) << left << "Format" << setw(14) << left << "Bytes" << setw(12) << left << "ms" << "MB/s" << endl;
+    cout << string(48, '-') << endl;
+    for (ReportFormat format : {REPORT_BINARY, REPORT_CSV}) {
+        written = ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0 && written;
+        ReportStats stats = writeReport(fd, format, 0, SIZE_MAX);
+        written = written && stats.ok && stats.rows == productCount;
+        cout << setw(10) << left << (format == REPORT_CSV ? "csv" : "binary") << setw(14) << left << stats.bytes
+             << setw(12) << left << stats.ms << stats.bytes / max(stats.ms, 1e-3) / 1000 << endl;
+    }
+    close(fd);
+    
+    // Round trip: empty the store and load the CSV export back in
+    for (size_t i = 0; i < productCount; i++) inventory.erase(skuOf(i));
+    ImportReport report;
+    bool imported = importFile(path, report) && report.imported == productCount && report.rejected == 0;
+    bool roundTrip = imported;
+    Product item;
+    for (size_t i = 0; i < productCount; i++) {
+        roundTrip = roundTrip && inventory.find(skuOf(i), item) && item.name == nameOf(i) && item.quantity == int(i % 1000);
+    }
+    cout << "CSV round trip: " << report.imported << " imported, " << report.rejected << " rejected" << endl;
+    cout << "Export results: " << (written && roundTrip ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
+    for (size_t i = 0; i < productCount; i++) inventory.erase(skuOf(i));
+    unlink(path);
+}
+
+// Binary protocol used by --serve and --loadgen. Every frame is
+//   u32 body length | u8 opcode (request) or WireStatus (response) | fields
+// in host byte order; strings are a u16 length followed by the bytes.
+// Requests on a connection may be pipelined: responses come back in order.
+//   FIND    sku                  -> status [name, i32 quantity, i32 reserved]
+//   INSERT  sku, name, i32 qty   -> status
+//   UPDATE  sku, i32 qty         -> status
+//   DELETE  sku                  -> status
+//   RESERVE / COMMIT / RELEASE  sku, i32 units -> status
+//   PING                         -> status
+//   METRICS                      -> status, JSON latency summary
+//   TRANSACTION  (sku, i32 delta) repeated, at most WIRE_MAX_TRANSACTION_LINES -> status [i32 failed line, from 0]
+// A replica (--follow) answers every request but FIND, PING and METRICS with
+// WIRE_READ_ONLY. A response whose name or JSON would not fit a frame is
+// replaced by a bare WIRE_TOO_LARGE.
+enum WireOp : uint8_t {
+    WIRE_FIND = 1, WIRE_INSERT = 2, WIRE_UPDATE = 3, WIRE_DELETE = 4,
+    WIRE_RESERVE = 5, WIRE_COMMIT = 6, WIRE_RELEASE = 7, WIRE_PING = 8, WIRE_METRICS = 9,
+    WIRE_TRANSACTION = 10
+};
+enum WireStatus : uint8_t { WIRE_OK = 0, WIRE_NOT_FOUND = 1, WIRE_DUPLICATE = 2, WIRE_INSUFFICIENT = 3, WIRE_BAD_REQUEST = 4,
+                          WIRE_READ_ONLY = 5, WIRE_TOO_LARGE = 6 };
+
+// Largest frame body accepted; anything bigger closes the connection
+const uint32_t WIRE_MAX_FRAME = 1 << 16;
+// Most lines one TRANSACTION frame may carry
+const size_t WIRE_MAX_TRANSACTION_LINES = 4096;
+
+// Appends one frame to a buffer; the length is filled in by finish()
+class WireWriter {
+private:
+    vector<char>& out;
+    size_t frameStart;
+    bool overflow;
+    
+public:
+    WireWriter(vector<char>& buffer, uint8_t code) : out(buffer), frameStart(buffer.size()), overflow(false) {
+        u32(0);
+        u8(code);
+    }
+    
+    void u8(uint8_t value) { out.push_back((char)value); }
+    void u32(uint32_t value) { out.insert(out.end(), (const char*)&value, (const char*)&value + 4); }
+    void i32(int32_t value) { u32((uint32_t)value); }
+    
+    // A string longer than a u16 length can describe is never cut short:
+    // it is left out and the frame marked as overflowed
+    void str(string_view text) {
+        if (text.size() > 0xFFFF) {
+            overflow = true;
+            return;
+        }
+        uint16_t length = text.size();
+        out.insert(out.end(), (const char*)&length, (const char*)&length + 2);
+        out.insert(out.end(), text.data(), text.data() + length);
+    }
+    
+    // Fill in the length; false (with the frame removed) if a string did
+    // not fit or the body is larger than WIRE_MAX_FRAME
+    bool finish() {
+        uint32_t length = out.size() - frameStart - 4;
+        if (overflow || length > WIRE_MAX_FRAME) {
+            out.resize(frameStart);
+            return false;
+        }
+        memcpy(&out[frameStart], &length, 4);
+        return true;
+    }
+};
+
+// Reads the fields of one frame body; any overrun makes the frame invalid
+class WireReader {
+private:
+    const char* at;
+    const char* end;
+    bool ok;
+    
+    bool take(void* target, size_t size) {
+        if ((size_t)(end - at) < size) return ok = false;
+        memcpy(target, at, size);
+        at += size;
+        return true;
+    }
+    
+public:
+    WireReader(const char* body, size_t size) : at(body), end(body + size), ok(true) {}
+    
+    uint8_t u8() { uint8_t v = 0; take(&v, 1); return v; }
+    int32_t i32() { int32_t v = 0; take(&v, 4); return v; }
+    
+    string_view str() {
+        uint16_t length = 0;
+        if (!take(&length, 2) || (size_t)(end - at) < length) {
+            ok = false;
+            return string_view();
+        }
+        string_view text(at, length);
+        at += length;
+        return text;
+    }
+    
+    // True if every field was present and nothing was left over
+    bool complete() const { return ok && at == end; }
+    bool atEnd() const { return at == end; }
+    // False once a field ran past the end of the frame
+    bool good() const { return ok; }
+};
+
+WireStatus wireStatus(OpStatus status) {
+    switch (status) {
+        case OP_OK: return WIRE_OK;
+        case OP_NOT_FOUND: return WIRE_NOT_FOUND;
+        case OP_DUPLICATE: return WIRE_DUPLICATE;
+        default: return WIRE_INSUFFICIENT;
+    }
+}
+
+// Apply one request and append its response. lastSequence tracks the newest
+// journal record so the caller can make it durable before replying.
+void handleWireRequest(const char* body, size_t size, vector<char>& out, uint64_t& lastSequence) {
+    WireReader in(body, size);
+    uint8_t op = in.u8();
+    string sku(in.str());
+    Product item;
+    OpStatus status = OP_OK;
+    bool found = false;
+    bool valid = true;
+    size_t failedLine = 0;
+    
+    if (replica.running() && op != WIRE_FIND && op != WIRE_PING && op != WIRE_METRICS) {
+        WireWriter reply(out, WIRE_READ_ONLY);
+        reply.finish();
+        return;
+    }
+    
+    switch (op) {
+        case WIRE_FIND:
+            valid = in.complete();
+            if (valid) found = inventory.find(sku, item);
+            status = found ? OP_OK : OP_NOT_FOUND;
+            break;
+        case WIRE_INSERT: {
+            string name(in.str());
+            int32_t quantity = in.i32();
+            valid = in.complete() && !sku.empty() && !name.empty() && quantity >= 0;
+            if (valid) status = inventory.insert(sku, name, quantity, &lastSequence);
+            break;
+        }
+        case WIRE_UPDATE: {
+            int32_t quantity = in.i32();
+            valid = in.complete() && quantity >= 0;
+            if (valid) status = inventory.update(sku, quantity, &lastSequence);
+            break;
+        }
+        case WIRE_DELETE:
+            valid = in.complete();
+            if (valid) status = inventory.erase(sku, nullptr, &lastSequence);
+            break;
+        case WIRE_RESERVE:
+        case WIRE_COMMIT:
+        case WIRE_RELEASE: {
+            int32_t units = in.i32();
+            valid = in.complete() && units > 0;
+            if (!valid) break;
+            if (op == WIRE_RESERVE) status = inventory.reserve(sku, units);
+            else if (op == WIRE_COMMIT) status = inventory.commitReserved(sku, units, &lastSequence);
+            else status = inventory.release(sku, units);
+            break;
+        }
+        case WIRE_TRANSACTION: {
+            vector<TransactionLine> lines;
+            lines.push_back(TransactionLine{sku, in.i32()});
+            // A trailing partial line fails a read without consuming it, so stop there
+            while (in.good() && !in.atEnd() && lines.size() < WIRE_MAX_TRANSACTION_LINES) {
+                string_view lineSku = in.str();
+                lines.push_back(TransactionLine{string(lineSku), in.i32()});
+            }
+            valid = in.complete();
+            if (valid) status = inventory.applyTransaction(lines, &failedLine, &lastSequence);
+            break;
+        }
+        case WIRE_PING:
+            valid = size == 1;
+            break;
+        case WIRE_METRICS:
+            valid = size == 1;
+            break;
+        default:
+            valid = false;
+    }
+    
+    WireWriter reply(out, valid ? wireStatus(status) : WIRE_BAD_REQUEST);
+    if (found) {
+        reply.str(item.name);
+        reply.i32(item.quantity);
+        reply.i32(item.reserved);
+    }
+    if (valid && op == WIRE_TRANSACTION && status != OP_OK) reply.i32((int32_t)failedLine);
+    if (valid && op == WIRE_METRICS) {
+        ostringstream json;
+        metrics.writeJson(json, false);
+        reply.str(json.str());
+    }
+    if (!reply.finish()) WireWriter(out, WIRE_TOO_LARGE).finish();
+}
+
+// One client of the server with its unparsed input and unsent responses
+struct ServerConnection {
+    int fd;
+    vector<char> input;
+    vector<char> output;
+    size_t outputSent;
+    bool watchingOutput;
+};
+
+// Set by SIGINT / SIGTERM to stop the server loop
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+// Serve the inventory over the binary protocol until SIGINT / SIGTERM.
+// One epoll loop handles every connection. Each wakeup reads what every
+// ready client sent and answers every complete frame, makes the journal
+// durable once for all of them (group commit across clients), then writes
+// the responses back.
+bool runServer(const string& address) {
+    int listener = openListener(address);
+    if (listener < 0) {
+        cout << "Error: Could not listen on " << address << "." << endl;
+        return false;
+    }
+    int epoll = epoll_create1(0);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+    
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    
+    cout << "Serving " << inventory.size() << " products on "
+         << (isTcpAddress(address) ? "127.0.0.1:" : "") << address << " (Ctrl+C to stop)" << endl;
+    
+    map<int, unique_ptr<ServerConnection>> connections;
+    vector<epoll_event> events(256);
+    vector<ServerConnection*> pending;
+    vector<char> chunk(1 << 16);
+    size_t served = 0;
+    
+    auto closeConnection = [&](ServerConnection* c) {
+        epoll_ctl(epoll, EPOLL_CTL_DEL, c->fd, nullptr);
+        ::close(c->fd);
+        connections.erase(c->fd);
+    };
+    
+    while (!stopRequested) {
+        int ready = epoll_wait(epoll, events.data(), events.size(), -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        
+        uint64_t lastSequence = 0;
+        pending.clear();
+        for (int e = 0; e < ready; e++) {
+            if (events[e].data.fd == listener) {
+                int client;
+                while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    int noDelay = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                    connections[client].reset(new ServerConnection{client, {}, {}, 0, false});
+                    epoll_event add = {};
+                    add.events = EPOLLIN;
+                    add.data.fd = client;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, client, &add);
+                }
+                continue;
+            }
+            
+            auto found = connections.find(events[e].data.fd);
+            if (found == connections.end()) continue;
+            ServerConnection* c = found->second.get();
+            
+            bool closed = false;
+            if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                while (true) {
+                    ssize_t got = read(c->fd, chunk.data(), chunk.size());
+                    if (got > 0) {
+                        c->input.insert(c->input.end(), chunk.data(), chunk.data() + got);
+                        continue;
+                    }
+                    if (got == 0 || (errno != EAGAIN && errno != EINTR)) closed = true;
+                    if (got < 0 && errno == EINTR) continue;
+                    break;
+                }
+                
+                // Answer every complete frame; a partial one waits for more input
+                size_t at = 0;
+                while (c->input.size() - at >= 4) {
+                    uint32_t length;
+                    memcpy(&length, c->input.data() + at, 4);
+                    if (length == 0 || length > WIRE_MAX_FRAME) {
+                        closed = true;
+                        break;
+                    }
+                    if (c->input.size() - at - 4 < length) break;
+                    handleWireRequest(c->input.data() + at + 4, length, c->output, lastSequence);
+                    at += 4 + length;
+                    served++;
+                }
+                c->input.erase(c->input.begin(), c->input.begin() + at);
+            }
+            if (closed) {
+                closeConnection(c);
+                continue;
+            }
+            pending.push_back(c);
+        }
+        
+        // Nothing is acknowledged before its journal record is durable
+        if (lastSequence != 0) commitMutation(lastSequence);
+        
+        for (ServerConnection* c : pending) {
+            while (c->outputSent < c->output.size()) {
+                ssize_t sent = write(c->fd, c->output.data() + c->outputSent, c->output.size() - c->outputSent);
+                if (sent <= 0) break;
+                c->outputSent += sent;
+            }
+            bool drained = c->outputSent == c->output.size();
+            if (drained) {
+                c->output.clear();
+                c->outputSent = 0;
+            }
+            if (drained == c->watchingOutput) {
+                // Watch for writability only while responses are backed up
+                c->watchingOutput = !drained;
+                epoll_event change = {};
+                change.events = drained ? (uint32_t)EPOLLIN : (uint32_t)(EPOLLIN | EPOLLOUT);
+                change.data.fd = c->fd;
+                epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &change);
+            }
+        }
+    }
+    
+    while (!connections.empty()) closeConnection(connections.begin()->second.get());
+    ::close(epoll);
+    ::close(listener);
+    if (!isTcpAddress(address)) unlink(address.c_str());
+    cout << "\nServer stopped after " << served << " requests." << endl;
+    return true;
+}
+
+// Read exactly count response frames from a blocking socket; statuses receives each status
+bool readResponses(int fd, size_t count, vector<char>& buffer, vector<uint8_t>& statuses) {
+    statuses.clear();
+    size_t filled = 0, at = 0;
+    buffer.resize(max<size_t>(buffer.size(), 1 << 16));
+    while (statuses.size() < count) {
+        uint32_t length;
+        if (filled - at >= 4) {
+            memcpy(&length, buffer.data() + at, 4);
+            if (length == 0 || length > WIRE_MAX_FRAME) return false;
+            if (filled - at - 4 >= length) {
+                statuses.push_back((uint8_t)buffer[at + 4]);
+                at += 4 + length;
+                continue;
+            }
+        }
+        // Keep the unparsed tail at the front and read more after it
+        memmove(buffer.data(), buffer.data() + at, filled - at);
+        filled -= at;
+        at = 0;
+        if (buffer.size() - filled < WIRE_MAX_FRAME + 4) buffer.resize(buffer.size() * 2);
+        ssize_t got = read(fd, buffer.data() + filled, buffer.size() - filled);
+        if (got <= 0) return false;
+        filled += got;
+    }
+    return filled == at;
+}
+
+// Drive a running server from several client connections, each keeping
+// `depth` requests in flight (90% FIND / 10% UPDATE on preloaded products),
+// and report throughput and round-trip latency
+void runLoadGenerator(const string& address, size_t connectionCount, size_t requestsPerConnection, size_t depth) {
+    const size_t productCount = 10000;
+    
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Server Load Test (" << address << ": " << connectionCount << " connections, pipeline depth " << depth << ")" << endl;
+    cout << string(70, '=') << endl;
+    
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) skus[i] = "LG" + to_string(i);
+    
+    // Preload the products (already present ones come back as duplicates)
+    int setup = connectTo(address);
+    if (setup < 0) {
+        cout << "Error: Could not connect to " << address << "." << endl;
+        return;
+    }
+    vector<char> request, response;
+    vector<uint8_t> statuses;
+    for (size_t i = 0; i < productCount; i++) {
+        WireWriter frame(request, WIRE_INSERT);
+        frame.str(skus[i]);
+        frame.str("Load test item " + to_string(i));
+        frame.i32(1000);
+        frame.finish();
+    }
+    bool loaded = sendAll(setup, request.data(), request.size()) && readResponses(setup, productCount, response, statuses);
+    ::close(setup);
+    if (!loaded) {
+        cout << "Error: preload failed." << endl;
+        return;
+    }
+    
+    atomic<size_t> completed(0), failures(0);
+    atomic<long long> roundTripNanos(0), roundTrips(0);
+    auto start = chrono::high_resolution_clock::now();
+    vector<thread> clients;
+    for (size_t c = 0; c < connectionCount; c++) {
+        clients.emplace_back([&, c] {
+            int fd = connectTo(address);
+            if (fd < 0) {
+                failures++;
+                return;
+            }
+            uint64_t state = 0x9E3779B97F4A7C15ull * (c + 1);
+            vector<char> out, in;
+            vector<uint8_t> replies;
+            long long nanos = 0, trips = 0;
+            for (size_t done = 0; done < requestsPerConnection;) {
+                size_t window = min(depth, requestsPerConnection - done);
+                out.clear();
+                for (size_t r = 0; r < window; r++) {
+                    state ^= state << 13;
+                    state ^= state >> 7;
+                    state ^= state << 17;
+                    bool update = state % 10 == 0;
+                    WireWriter frame(out, update ? WIRE_UPDATE : WIRE_FIND);
+                    frame.str(skus[(state >> 8) % productCount]);
+                    if (update) frame.i32((int32_t)(state >> 40) % 1000);
+                    frame.finish();
+                }
+                auto sentAt = chrono::high_resolution_clock::now();
+                if (!sendAll(fd, out.data(), out.size()) || !readResponses(fd, window, in, replies)) {
+                    failures++;
+                    break;
+                }
+                nanos += chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - sentAt).count();
+                trips++;
+                for (uint8_t status : replies) {
+                    if (status != WIRE_OK) failures++;
+                }
+                done += window;
+                completed += window;
+            }
+            roundTripNanos += nanos;
+            roundTrips += trips;
+            ::close(fd);
+        });
+    }
+    for (auto& t : clients) t.join();
+    double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    
+    cout << fixed << setprecision(2);
+    cout << "Requests: " << completed << " in " << seconds << " s (" << completed / seconds / 1000 << " K req/s)" << endl;
+    if (roundTrips > 0) {
+        double roundTripMicros = roundTripNanos / 1000.0 / roundTrips;
+        cout << "Round trip: " << roundTripMicros << " us per window of " << depth << " ("
+             << roundTripMicros / depth << " us per request)" << endl;
+    }
+    cout << "Errors: " << failures << endl;
+    cout.unsetf(ios::fixed);
+    
+    // The server's own view of the same run
+    int fd = connectTo(address);
+    vector<char> ask;
+    WireWriter(ask, WIRE_METRICS).finish();
+    if (fd >= 0 && sendAll(fd, ask.data(), ask.size()) && readResponses(fd, 1, response, statuses) &&
+        statuses[0] == WIRE_OK) {
+        uint32_t length;
+        memcpy(&length, response.data(), 4);
+        WireReader in(response.data() + 4, length);
+        in.u8();
+        cout << "Server metrics: " << in.str() << endl;
+    }
+    if (fd >= 0) ::close(fd);
+}
+
+// Measure a 90% searchBySKU / 10% updateQuantity mix on 1, 2, 4, 8 and 16
+// threads, against a single-lock store and against the sharded store
+void runThreadBenchmark(size_t productCount, size_t shardCount) {
+    const size_t totalOps = 4000000;
+    const size_t threadCounts[] = {1, 2, 4, 8, 16};
+    
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) skus[i] = "SKU" + to_string(i);
+    
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Concurrent Inventory Benchmark" << endl;
+    cout << productCount << " products, " << totalOps << " operations (90% search / 10% update)" << endl;
+    cout << string(70, '=') << endl;
+    
+    vector<size_t> configurations = {1, shardCount};
+    vector<vector<double>> throughput(configurations.size());
+    for (size_t c = 0; c < configurations.size(); c++) {
+        ShardedInventory store(configurations[c]);
+        for (size_t i = 0; i < productCount; i++) store.insert(skus[i], "Product " + to_string(i), (int)(i % 1000));
+        
+        for (size_t threads : threadCounts) {
+            auto start = chrono::high_resolution_clock::now();
+            vector<thread> pool;
+            for (size_t t = 0; t < threads; t++) {
+                pool.emplace_back([&, t] {
+                    uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+                    Product item;
+                    for (size_t op = 0; op < totalOps / threads; op++) {
+                        // xorshift64
+                        state ^= state << 13;
+                        state ^= state >> 7;
+                        state ^= state << 17;
+                        const string& sku = skus[state % productCount];
+                        if (state % 10 == 0) store.update(sku, (int)(op & 1023));
+                        else store.find(sku, item);
+                    }
+                });
+            }
+            for (auto& t : pool) t.join();
+            double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+            throughput[c].push_back(totalOps / seconds / 1e6);
+        }
+    }
+    
+    cout << setw(10) << left << "Threads"
+         << setw(22) << left << "1 shard (Mops/s)"
+         << setw(22) << left << (to_string(configurations[1]) + " shards (Mops/s)") << endl;
+    cout << string(54, '-') << endl;
+    for (size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++) {
+        cout << setw(10) << left << threadCounts[i]
+             << setw(22) << left << fixed << setprecision(3) << throughput[0][i]
+             << setw(22) << left << throughput[1][i] << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << "Hardware threads: " << thread::hardware_concurrency() << endl;
+}
 
-// Function to check if a string contains only digits
-bool isNumeric(const string& str) {
-    if (str.empty()) return false;
-    for (char c : str) {
-        if (!isdigit(c)) return false;
+// Check the reservation API under contention: first drain every product
+// with concurrent 1-unit reservations (must stop exactly at the stock on
+// hand), then run a reserve -> commit/release mix and verify the totals
+void runReservationBenchmark(size_t threads) {
+    const size_t productCount = 64;
+    const int stockPerProduct = 100000;
+    const size_t mixedOps = 4000000;
+    
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) skus[i] = "HOT" + to_string(i);
+    
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Reservation Benchmark (" << threads << " threads, " << productCount << " hot products)" << endl;
+    cout << string(70, '=') << endl;
+    
+    // Phase 1: drain all stock with concurrent reservations
+    ShardedInventory store;
+    for (const string& sku : skus) store.insert(sku, "Hot item", stockPerProduct);
+    
+    atomic<long long> granted(0);
+    auto start = chrono::high_resolution_clock::now();
+    vector<thread> pool;
+    for (size_t t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            long long mine = 0;
+            for (size_t p = t; p < t + productCount; p++) {
+                const string& sku = skus[p % productCount];
+                while (store.reserve(sku, 1) == OP_OK) mine++;
+            }
+            granted += mine;
+        });
     }
-    return true;
+    for (auto& t : pool) t.join();
+    double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    
+    long long onHandTotal, reservedTotal;
+    store.stockTotals(onHandTotal, reservedTotal);
+    long long expected = (long long)productCount * stockPerProduct;
+    cout << "Drain: " << granted << " reservations granted for " << expected << " units on hand ("
+         << fixed << setprecision(2) << granted / seconds / 1e6 << " M/s)" << endl;
+    cout << "Oversell check: " << (granted == expected && reservedTotal == expected ? "✓ PASSED" : "✗ FAILED") << endl;
+    
+    // Phase 2: reserve then commit or release, on a fresh store
+    ShardedInventory mixed;
+    for (const string& sku : skus) mixed.insert(sku, "Hot item", stockPerProduct);
+    atomic<long long> committed(0);
+    
+    start = chrono::high_resolution_clock::now();
+    pool.clear();
+    for (size_t t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+            long long mine = 0;
+            for (size_t op = 0; op < mixedOps / threads; op++) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                const string& sku = skus[state % productCount];
+                if (mixed.reserve(sku, 1) != OP_OK) continue;
+                if (state & 0x100) {
+                    mixed.commitReserved(sku, 1);
+                    mine++;
+                } else {
+                    mixed.release(sku, 1);
+                }
+            }
+            committed += mine;
+        });
+    }
+    for (auto& t : pool) t.join();
+    seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    
+    long long onHand, stillReserved;
+    mixed.stockTotals(onHand, stillReserved);
+    cout << "Mixed: " << mixedOps << " reserve + commit/release pairs in " << seconds << " s ("
+         << mixedOps / seconds / 1e6 << " M pairs/s)" << endl;
+    cout << "Balance check: " << (onHand + committed == expected && stillReserved == 0 ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
 }
 
-// Function to insert a new product
-void insertProduct() {
-    string sku, name, quantityStr;
-    int quantity;
+// Time fuzzy name search on a synthetic catalog: each query is a catalog
+// name with one or two random typos, and recall counts how often the
+// original name comes back
+void runFuzzyBenchmark(size_t productCount, size_t shardCount) {
+    const size_t queryCount = 2000;
+    const size_t vocabularySize = 5000;
+    const char* syllables[] = {"ka", "lo", "mi", "ren", "to", "sa", "vel", "ix", "or", "pa", "dun", "e",
+                               "ber", "qua", "zo", "li", "mar", "tek", "no", "ga", "ster", "fi", "ul", "ro"};
     
-    cout << "Enter SKU: ";
-    getline(cin, sku);
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Fuzzy Name Search Benchmark (" << productCount << " products, " << shardCount << " shards)" << endl;
+    cout << string(70, '=') << endl;
     
-    // Check for duplicate SKU
-    for (const auto& item : inventory) {
-        if (item.sku == sku) {
-            cout << "Product with this SKU already exists!" << endl;
-            return;
+    ShardedInventory store(shardCount);
+    vector<string> names(productCount);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    
+    // Names are three words from a vocabulary of made-up words plus a model number
+    vector<string> vocabulary(vocabularySize);
+    for (string& word : vocabulary) {
+        for (size_t n = 2 + next() % 3; n > 0; n--) word += syllables[next() % 24];
+        word[0] = (char)toupper((unsigned char)word[0]);
+    }
+    auto buildStart = chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < productCount; i++) {
+        names[i] = vocabulary[next() % vocabularySize] + " " + vocabulary[next() % vocabularySize] + " " +
+                   vocabulary[next() % vocabularySize] + " " + to_string(next() % 1000);
+        store.insert("FZ" + to_string(i), names[i], 1);
+    }
+    double buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - buildStart).count();
+    
+    vector<double> latencies;
+    size_t recalled = 0, returned = 0;
+    for (size_t q = 0; q < queryCount; q++) {
+        const string& original = names[next() % productCount];
+        string query = original;
+        for (size_t typo = 0; typo < 1 + next() % 2; typo++) {
+            size_t at = next() % query.size();
+            switch (next() % 3) {
+                case 0: query[at] = (char)('a' + next() % 26); break;
+                case 1: query.erase(at, 1); break;
+                default: query.insert(query.begin() + at, (char)('a' + next() % 26));
+            }
+        }
+        
+        auto start = chrono::high_resolution_clock::now();
+        vector<FuzzyProduct> found = store.fuzzySearchByName(query);
+        latencies.push_back(chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+        returned += found.size();
+        for (const FuzzyProduct& match : found) {
+            if (match.product.name == original) {
+                recalled++;
+                break;
+            }
         }
     }
     
-    cout << "Enter Product Name: ";
-    getline(cin, name);
+    sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double ms : latencies) total += ms;
+    size_t nameCount, words, trigrams;
+    store.nameIndexSizes(nameCount, words, trigrams);
+    cout << fixed << setprecision(3);
+    cout << "Catalog load: " << buildMs << " ms (" << nameCount << " distinct names, " << trigrams << " trigram lists)" << endl;
+    cout << "Queries: " << queryCount << " with 1-2 typos, " << (double)returned / queryCount << " results each" << endl;
+    cout << "Latency: avg " << total / queryCount << " ms, p50 " << latencies[queryCount / 2] << " ms, p99 "
+         << latencies[queryCount * 99 / 100] << " ms, max " << latencies.back() << " ms" << endl;
+    cout << "Recall: " << 100.0 * recalled / queryCount << "% of queries returned the original name" << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// The original single-vector store: every lookup, update and delete is a
+// linear scan, kept as the baseline for the workload benchmark
+class LegacyInventory {
+private:
+    vector<Product> items;
     
-    // Validate: product name cannot be empty
-    if (name.empty()) {
-        cout << "Error: Product name cannot be empty." << endl;
-        return;
+    size_t position(const string& sku) const {
+        for (size_t i = 0; i < items.size(); i++) {
+            if (items[i].sku == sku) return i;
+        }
+        return items.size();
     }
     
-    cout << "Enter Quantity: ";
-    getline(cin, quantityStr);
+public:
+    // Bulk load of SKUs known to be unique, skipping the duplicate scan
+    void load(const string& sku, const string& name, int quantity) { items.push_back(Product{sku, name, quantity, 0}); }
     
-    // Validate: quantity must be numeric
-    if (!isNumeric(quantityStr)) {
-        cout << "Invalid input. Quantity must be a number." << endl;
-        return;
+    OpStatus insert(const string& sku, const string& name, int quantity) {
+        if (position(sku) != items.size()) return OP_DUPLICATE;
+        items.push_back(Product{sku, name, quantity, 0});
+        return OP_OK;
     }
     
-    quantity = stoi(quantityStr);
+    bool find(const string& sku, Product& out) const {
+        size_t i = position(sku);
+        if (i == items.size()) return false;
+        out = items[i];
+        return true;
+    }
     
-    // Validate: quantity must be positive
-    if (quantity < 0) {
-        cout << "Error: Quantity must be positive." << endl;
-        return;
+    OpStatus update(const string& sku, int quantity) {
+        size_t i = position(sku);
+        if (i == items.size()) return OP_NOT_FOUND;
+        items[i].quantity = quantity;
+        return OP_OK;
     }
     
-    // Create product and add to inventory
-    Product product = {sku, name, quantity};
-    inventory.push_back(product);
-    cout << "Product inserted successfully." << endl;
+    OpStatus erase(const string& sku) {
+        size_t i = position(sku);
+        if (i == items.size()) return OP_NOT_FOUND;
+        items.erase(items.begin() + i);
+        return OP_OK;
+    }
+};
+
+// YCSB's Zipfian generator (Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases"): rank 0 is the most popular of n items
+class ZipfianGenerator {
+private:
+    uint64_t items;
+    double theta, zetan, alpha, eta, halfPowTheta;
+    
+public:
+    ZipfianGenerator(uint64_t n, double skew = 0.99) : items(n), theta(skew), zetan(0) {
+        for (uint64_t i = 1; i <= n; i++) zetan += 1.0 / pow((double)i, theta);
+        alpha = 1.0 / (1.0 - theta);
+        halfPowTheta = pow(0.5, theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - (1.0 + halfPowTheta) / zetan);
+    }
+    
+    // Rank for a uniform sample u in [0, 1)
+    uint64_t next(double u) const {
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + halfPowTheta) return 1;
+        return min(items - 1, (uint64_t)(items * pow(eta * u - eta + 1.0, alpha)));
+    }
+};
+
+enum WorkloadOp { WORK_READ, WORK_UPDATE, WORK_INSERT, WORK_DELETE, WORK_OP_COUNT };
+const char* const WORKLOAD_OP_NAMES[WORK_OP_COUNT] = {"read", "update", "insert", "delete"};
+
+// Operation mix in percent, summing to 100
+struct WorkloadMix {
+    string name;
+    int percent[WORK_OP_COUNT];
+};
+
+// Latencies and outcome of one store running one workload
+struct WorkloadResult {
+    size_t operations;
+    size_t misses;
+    double seconds;
+    vector<uint32_t> nanos[WORK_OP_COUNT];
+};
+
+// Deterministic catalog for the workload benchmark: SKUs carry a category
+// prefix and a scrambled serial, names combine brand, item, and variant
+struct WorkloadCatalog {
+    vector<string> skus;
+    vector<string> names;
+    
+    static string skuFor(uint64_t id) {
+        static const char* categories[] = {"ELC", "HOM", "GRD", "TOY", "APP", "SPT", "AUT", "OFF"};
+        uint64_t serial = (id * 0x9E3779B97F4A7C15ull) >> 40;
+        string digits = to_string(serial % 100000000);
+        return string("SKU-") + categories[id % 8] + "-" + string(8 - digits.size(), '0') + digits + "-" + to_string(id);
+    }
+    
+    static string nameFor(uint64_t id) {
+        static const char* brands[] = {"Acme", "Northwind", "Contoso", "Globex", "Initech", "Umbrella", "Stark", "Wayne"};
+        static const char* things[] = {"Cordless Drill", "Desk Lamp", "Garden Hose", "Puzzle Set", "Rain Jacket",
+                                       "Yoga Mat", "Brake Pads", "Stapler", "Blender", "Headphones", "Backpack"};
+        static const char* variants[] = {"Black", "Blue", "Large", "Small", "Pro", "Mini", "Red", "XL"};
+        uint64_t h = id * 0xC2B2AE3D27D4EB4Full;
+        return string(brands[(h >> 13) % 8]) + " " + things[(h >> 23) % 11] + " " + variants[(h >> 33) % 8] + " " +
+               to_string((h >> 43) % 1000);
+    }
+    
+    void grow(size_t count) {
+        for (size_t id = skus.size(); id < count; id++) {
+            skus.push_back(skuFor(id));
+            names.push_back(nameFor(id));
+        }
+    }
+};
+
+// Run ops operations of mix against store (for at most timeLimit seconds).
+// Keys come from a scrambled Zipfian over the preloaded records, or are
+// uniform; inserts add new keys that later draws may pick.
+template <class Store>
+WorkloadResult runWorkload(Store& store, const WorkloadCatalog& catalog, size_t preloaded, const WorkloadMix& mix,
+                           const ZipfianGenerator* zipf, size_t ops, double timeLimit) {
+    WorkloadResult result{0, 0, 0, {}};
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    size_t keyCount = preloaded;
+    Product item;
+    
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(timeLimit));
+    for (size_t op = 0; op < ops; op++) {
+        // Checking the clock every 256 operations keeps it off the hot path
+        if ((op & 255) == 0 && chrono::steady_clock::now() > deadline) break;
+        int dice = (int)(next() % 100);
+        int kind = 0;
+        while (kind < WORK_OP_COUNT - 1 && dice >= mix.percent[kind]) dice -= mix.percent[kind++];
+        
+        size_t key;
+        if (kind == WORK_INSERT) {
+            if (keyCount >= catalog.skus.size()) continue;
+            key = keyCount++;
+        } else if (zipf) {
+            uint64_t rank = zipf->next((next() >> 11) * 0x1.0p-53);
+            key = (size_t)((rank * 0xCBF29CE484222325ull ^ (rank >> 7)) % keyCount);
+        } else {
+            key = next() % keyCount;
+        }
+        const string& sku = catalog.skus[key];
+        
+        auto opStart = chrono::steady_clock::now();
+        bool hit;
+        switch (kind) {
+            case WORK_READ: hit = store.find(sku, item); break;
+            case WORK_UPDATE: hit = store.update(sku, (int)(next() % 1000)) == OP_OK; break;
+            case WORK_INSERT: hit = store.insert(sku, catalog.names[key], (int)(key % 1000)) == OP_OK; break;
+            default: hit = store.erase(sku) == OP_OK;
+        }
+        auto nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - opStart).count();
+        result.nanos[kind].push_back((uint32_t)min<long long>(nanos, UINT32_MAX));
+        if (!hit) result.misses++;
+        result.operations++;
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
 }
 
-// Function to display all products in inventory
-void displayInventory() {
-    if (inventory.empty()) {
-        cout << "Inventory is empty." << endl;
-        return;
+// Print throughput and p50/p99/p999 latency per operation type
+void printWorkloadResult(const string& storeName, WorkloadResult& result) {
+    cout << "  " << setw(9) << left << storeName << result.operations << " ops in " << result.seconds << " s: "
+         << result.operations / result.seconds / 1000 << " Kops/s (" << result.misses << " misses)" << endl;
+    for (int kind = 0; kind < WORK_OP_COUNT; kind++) {
+        vector<uint32_t>& samples = result.nanos[kind];
+        if (samples.empty()) continue;
+        sort(samples.begin(), samples.end());
+        auto at = [&samples](double q) { return samples[min(samples.size() - 1, (size_t)(samples.size() * q))] / 1000.0; };
+        cout << "    " << setw(8) << left << WORKLOAD_OP_NAMES[kind] << setw(10) << left << samples.size()
+             << "p50 " << at(0.5) << " us, p99 " << at(0.99) << " us, p999 " << at(0.999) << " us" << endl;
     }
+}
+
+// YCSB-style driver: preload a catalog, then run each operation mix with
+// Zipfian and uniform key popularity against the original linear-scan
+// vector store and the sharded, indexed store
+void runWorkloadBenchmark(size_t productCount, size_t ops, size_t shardCount, const vector<WorkloadMix>& mixes,
+                          const string& distribution) {
+    const double timeLimit = 3.0;
     
-    cout << "\nCurrent Inventory:" << endl;
-    cout << setw(15) << left << "SKU" 
-         << setw(25) << left << "Product Name" 
-         << setw(15) << left << "Quantity" << endl;
-    cout << "-----------------------------------------------" << endl;
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Workload Benchmark (" << productCount << " products, up to " << ops << " operations or "
+         << timeLimit << " s per run)" << endl;
+    cout << string(70, '=') << endl;
     
-    for (const auto& item : inventory) {
-        cout << setw(15) << left << item.sku 
-             << setw(25) << left << item.name 
-             << setw(15) << left << item.quantity << endl;
+    WorkloadCatalog catalog;
+    catalog.grow(productCount + ops);
+    ZipfianGenerator zipf(productCount);
+    vector<string> distributions;
+    if (distribution != "uniform") distributions.push_back("zipfian");
+    if (distribution != "zipfian") distributions.push_back("uniform");
+    
+    cout << fixed << setprecision(2);
+    for (const WorkloadMix& mix : mixes) {
+        for (const string& keys : distributions) {
+            string shares;
+            for (int kind = 0; kind < WORK_OP_COUNT; kind++) {
+                if (mix.percent[kind] == 0) continue;
+                if (!shares.empty()) shares += ", ";
+                shares += to_string(mix.percent[kind]) + "% " + WORKLOAD_OP_NAMES[kind];
+            }
+            cout << "\nWorkload " << mix.name << " (" << shares << "), " << keys << " keys" << endl;
+            const ZipfianGenerator* generator = keys == "zipfian" ? &zipf : nullptr;
+            
+            // Each run starts from a freshly loaded store
+            double legacyRate, indexedRate;
+            {
+                LegacyInventory legacy;
+                for (size_t i = 0; i < productCount; i++) legacy.load(catalog.skus[i], catalog.names[i], (int)(i % 1000));
+                WorkloadResult result = runWorkload(legacy, catalog, productCount, mix, generator, ops, timeLimit);
+                printWorkloadResult("vector", result);
+                legacyRate = result.operations / result.seconds;
+            }
+            {
+                ShardedInventory indexed(shardCount);
+                for (size_t i = 0; i < productCount; i++) indexed.insert(catalog.skus[i], catalog.names[i], (int)(i % 1000));
+                WorkloadResult result = runWorkload(indexed, catalog, productCount, mix, generator, ops, timeLimit);
+                printWorkloadResult("indexed", result);
+                indexedRate = result.operations / result.seconds;
+            }
+            cout << "  Speedup: " << indexedRate / legacyRate << "x" << endl;
+        }
     }
-    cout << endl;
+    cout.unsetf(ios::fixed);
 }
 
-// Function to search product by SKU
-void searchBySKU() {
-    string sku;
-    cout << "Enter SKU to search: ";
-    getline(cin, sku);
+// Change feed demo: two local subscribers tail the feed while writer threads
+// mutate a store. The fast one mirrors stock levels from large batches; the
+// slow one sleeps after every small batch, gets overrun, and resynchronizes
+// from a read view. Both mirrors must match the store once writers stop.
+void runFeedDemo(size_t operationCount) {
+    const size_t skuCount = 10000;
+    const size_t writerCount = 2;
     
-    for (const auto& item : inventory) {
-        if (item.sku == sku) {
-            cout << "\nProduct Found:" << endl;
-            cout << "SKU: " << item.sku << endl;
-            cout << "Name: " << item.name << endl;
-            cout << "Quantity: " << item.quantity << endl;
-            return;
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Change Feed Demo (" << operationCount << " operations, " << writerCount << " writers)" << endl;
+    cout << string(70, '=') << endl;
+    
+    ShardedInventory store;
+    ChangeFeed feed;
+    store.attachFeed(&feed);
+    vector<string> skus(skuCount);
+    for (size_t i = 0; i < skuCount; i++) skus[i] = "CDC" + to_string(i);
+    
+    struct Mirror {
+        unordered_map<string, int> stock;
+        FeedCursor cursor;
+        size_t events, batches, resyncs;
+        uint64_t maxLag;
+    };
+    auto follow = [&](Mirror& mirror, size_t maxBatch, int pauseMicros) {
+        vector<ChangeEvent> batch;
+        while (true) {
+            FeedStatus status = feed.poll(mirror.cursor, batch, maxBatch, 50);
+            if (status == FEED_CLOSED) break;
+            if (status == FEED_OVERRUN) {
+                // Events were lost: restart at the feed head and reload from a
+                // read view. Events are absolute, so any overlap replays safely.
+                FeedCursor lost = mirror.cursor;
+                mirror.cursor = feed.subscribe();
+                mirror.cursor.missed = lost.missed;
+                mirror.cursor.overruns = lost.overruns;
+                mirror.stock.clear();
+                store.forEachAt([&mirror](const Product& item) { mirror.stock[item.sku] = item.quantity; });
+                mirror.resyncs++;
+                continue;
+            }
+            if (batch.empty()) continue;
+            mirror.maxLag = max(mirror.maxLag, feed.lag(mirror.cursor) + batch.size());
+            for (const ChangeEvent& event : batch) {
+                if (event.kind == CHANGE_DELETE) mirror.stock.erase(event.sku);
+                else mirror.stock[event.sku] = event.quantity;
+            }
+            mirror.events += batch.size();
+            mirror.batches++;
+            if (pauseMicros > 0) this_thread::sleep_for(chrono::microseconds(pauseMicros));
         }
+    };
+    
+    Mirror fast{{}, feed.subscribe(), 0, 0, 0, 0};
+    Mirror slow{{}, feed.subscribe(), 0, 0, 0, 0};
+    thread fastThread(follow, ref(fast), 4096, 0);
+    thread slowThread(follow, ref(slow), 64, 1000);
+    
+    auto start = chrono::high_resolution_clock::now();
+    vector<thread> writers;
+    for (size_t w = 0; w < writerCount; w++) {
+        writers.emplace_back([&, w] {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (w + 1);
+            for (size_t op = 0; op < operationCount / writerCount; op++) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                const string& sku = skus[(state >> 8) % skuCount];
+                switch (state % 8) {
+                    case 0: store.erase(sku); break;
+                    case 1: store.insert(sku, "Feed item", (int)(state >> 40) % 500); break;
+                    case 2:
+                        if (store.reserve(sku, 1) == OP_OK) store.commitReserved(sku, 1);
+                        break;
+                    default:
+                        if (store.update(sku, (int)(state >> 40) % 500) == OP_NOT_FOUND) store.insert(sku, "Feed item", 1);
+                }
+            }
+        });
+    }
+    for (auto& t : writers) t.join();
+    double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    feed.close();
+    fastThread.join();
+    slowThread.join();
+    
+    unordered_map<string, int> expected;
+    store.forEachAt([&expected](const Product& item) { expected[item.sku] = item.quantity; });
+    FeedStats stats = feed.stats();
+    
+    cout << fixed << setprecision(2);
+    cout << "Published: " << stats.published << " events in " << seconds << " s (" << stats.published / seconds / 1e6
+         << " M events/s), ring of " << stats.capacity << endl;
+    for (Mirror* mirror : {&fast, &slow}) {
+        cout << (mirror == &fast ? "Fast" : "Slow") << " subscriber: " << mirror->events << " events in "
+             << mirror->batches << " batches (avg " << (mirror->batches ? (double)mirror->events / mirror->batches : 0.0)
+             << "), max lag " << mirror->maxLag << ", " << mirror->cursor.overruns << " overruns, "
+             << mirror->cursor.missed << " events missed, " << mirror->resyncs << " resyncs" << endl;
+        cout << "  Mirror check: " << (mirror->stock == expected ? "✓ PASSED" : "✗ FAILED") << endl;
+    }
+    cout.unsetf(ios::fixed);
+}
+
+// Time SKU lookups with and without the Bloom filter in front of the SKU
+// index: present SKUs, typos of present SKUs (one character changed) and
+// probes from another catalog, and measure the filter's false-positive rate
+void runBloomBenchmark(size_t productCount, size_t shardCount) {
+    const size_t queryCount = 2000000;
+    
+    cout << "\n" << string(70, '=') << endl;
+    cout << "SKU Bloom Filter Benchmark (" << productCount << " products, " << shardCount << " shards)" << endl;
+    cout << string(70, '=') << endl;
+    
+    ShardedInventory store(shardCount);
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) {
+        skus[i] = "SKU" + to_string(100000000 + i * 10);
+        store.insert(skus[i], "Product", 1);
+    }
+    
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    vector<string> present(queryCount), typos(queryCount), foreign(queryCount);
+    for (size_t q = 0; q < queryCount; q++) {
+        present[q] = skus[next() % productCount];
+        // Every SKU ends in 0, so changing the last digit never hits another one
+        typos[q] = skus[next() % productCount];
+        typos[q].back() = (char)('1' + next() % 9);
+        foreign[q] = "EXT-" + to_string(next() % 100000000);
+    }
+    
+    auto timeLookups = [&store](const vector<string>& queries, size_t& hits) {
+        Product item;
+        hits = 0;
+        auto start = chrono::high_resolution_clock::now();
+        for (const string& sku : queries) hits += store.find(sku, item);
+        return chrono::duration<double, nano>(chrono::high_resolution_clock::now() - start).count() / queries.size();
+    };
+    
+    cout << fixed << setprecision(1);
+    cout << setw(26) << left << "Lookups" << setw(18) << left << "No filter (ns)" << setw(18) << left << "Filter (ns)"
+         << "Found" << endl;
+    cout << string(68, '-') << endl;
+    bool correct = true;
+    for (const vector<string>* queries : {&present, &typos, &foreign}) {
+        size_t hitsWithout, hitsWith;
+        store.setSkuFilter(false);
+        double without = timeLookups(*queries, hitsWithout);
+        store.setSkuFilter(true);
+        double with = timeLookups(*queries, hitsWith);
+        correct = correct && hitsWith == hitsWithout && hitsWith == (queries == &present ? queryCount : 0);
+        cout << setw(26) << left << (queries == &present ? "present" : queries == &typos ? "typo (absent)" : "other catalog (absent)")
+             << setw(18) << left << without << setw(18) << left << with << hitsWith << endl;
     }
     
-    cout << "Product with SKU " << sku << " not found." << endl;
+    IndexStats s = store.indexStats();
+    cout << setprecision(3);
+    cout << "Filter: " << s.filterBytes << " bytes (" << 8.0 * s.filterBytes / s.entries << " bits per SKU, SKU index "
+         << s.capacity * sizeof(SkuIndex::Slot) << " bytes)" << endl;
+    cout << "False positives: " << s.filterFalsePositives << " of " << s.filterRejects + s.filterFalsePositives
+         << " absent lookups (" << 100.0 * s.filterFalsePositives / max<uint64_t>(1, s.filterRejects + s.filterFalsePositives)
+         << "%)" << endl;
+    cout << "Lookup results: " << (correct ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
 }
 
-// Function to search product by Name
-void searchByName() {
-    string name;
-    cout << "Enter Product Name to search: ";
-    getline(cin, name);
+// Measure multi-line transactions: lines per second as the batch grows, in
+// memory and with every transaction made durable, against committing each
+// line on its own. Then run concurrent transfers (one SKU down, another up)
+// while a reader takes point-in-time views, and check that stock is
+// conserved both at the end and in every view.
+void runTransactionBenchmark(size_t productCount, size_t shardCount) {
+    const size_t batchSizes[] = {1, 10, 50, 200};
+    const double cellSeconds = 1.0;
+    const int startingStock = 1000000;
     
-    bool found = false;
-    for (const auto& item : inventory) {
-        if (item.name == name) {
-            if (!found) {
-                cout << "\nProducts Found:" << endl;
-                found = true;
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Transaction Benchmark (" << productCount << " products, " << shardCount << " shards)" << endl;
+    cout << string(70, '=') << endl;
+    
+    ShardedInventory store(shardCount);
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) {
+        skus[i] = "TX" + to_string(i);
+        store.insert(skus[i], "Transaction item", startingStock);
+    }
+    
+    char walPath[] = "/tmp/inventory-txn-XXXXXX";
+    int walFd = mkstemp(walPath);
+    if (walFd < 0) {
+        cout << "Error: could not create a scratch journal." << endl;
+        return;
+    }
+    close(walFd);
+    Journal wal;
+    wal.open(walPath, 0, 0, false);
+    
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    auto randomLines = [&](size_t n) {
+        vector<TransactionLine> lines(n);
+        for (TransactionLine& line : lines) {
+            uint64_t r = next();
+            line.sku = skus[r % productCount];
+            line.delta = (r >> 40) & 1 ? 1 : -1;
+        }
+        return lines;
+    };
+    // Lines per second of body(lines), run over fresh batches for cellSeconds
+    auto linesPerSecond = [&](size_t batch, auto body) {
+        size_t lines = 0;
+        auto start = chrono::high_resolution_clock::now();
+        double seconds;
+        do {
+            body(randomLines(batch));
+            lines += batch;
+            seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        } while (seconds < cellSeconds);
+        return lines / seconds;
+    };
+    
+    cout << fixed << setprecision(0);
+    cout << setw(10) << left << "Lines" << setw(24) << left << "In memory (lines/s)"
+         << setw(24) << left << "Durable (lines/s)" << endl;
+    cout << string(58, '-') << endl;
+    for (size_t batch : batchSizes) {
+        store.attachJournal(nullptr);
+        double memory = linesPerSecond(batch, [&](const vector<TransactionLine>& lines) { store.applyTransaction(lines); });
+        store.attachJournal(&wal);
+        double durable = linesPerSecond(batch, [&](const vector<TransactionLine>& lines) {
+            uint64_t sequence = 0;
+            store.applyTransaction(lines, nullptr, &sequence);
+            wal.commit(sequence);
+        });
+        cout << setw(10) << left << batch << setw(24) << left << memory << setw(24) << left << durable << endl;
+    }
+    double separate = linesPerSecond(50, [&](const vector<TransactionLine>& lines) {
+        for (const TransactionLine& line : lines) {
+            uint64_t sequence = 0;
+            store.applyTransaction({line}, nullptr, &sequence);
+            wal.commit(sequence);
+        }
+    });
+    store.attachJournal(nullptr);
+    cout << "50 lines committed one at a time: " << separate << " lines/s" << endl;
+    wal.close();
+    unlink(walPath);
+    
+    // Transfers on a small hot set, so transactions collide on shards and rows
+    const size_t hotCount = min<size_t>(64, productCount);
+    const int hotStock = 100;
+    ShardedInventory hot(shardCount);
+    for (size_t i = 0; i < hotCount; i++) hot.insert(skus[i], "Hot item", hotStock);
+    const long long expected = (long long)hotCount * hotStock;
+    
+    atomic<bool> stop(false);
+    atomic<long long> applied(0), refused(0);
+    size_t views = 0, tornViews = 0;
+    thread reader([&] {
+        while (!stop.load()) {
+            long long total = 0;
+            hot.forEachAt([&](const Product& item) { total += item.quantity; });
+            views++;
+            if (total != expected) tornViews++;
+        }
+    });
+    vector<thread> pool;
+    for (size_t t = 0; t < 4; t++) {
+        pool.emplace_back([&, t] {
+            uint64_t x = 0x2545F4914F6CDD1Dull * (t + 1);
+            long long ok = 0, failed = 0;
+            auto start = chrono::high_resolution_clock::now();
+            while (chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() < cellSeconds) {
+                for (int k = 0; k < 256; k++) {
+                    x ^= x << 13;
+                    x ^= x >> 7;
+                    x ^= x << 17;
+                    int units = 1 + (int)(x >> 60);
+                    vector<TransactionLine> lines = {{skus[x % hotCount], -units}, {skus[(x >> 20) % hotCount], units},
+                                                     {skus[(x >> 40) % hotCount], 0}};
+                    if (hot.applyTransaction(lines) == OP_OK) ok++;
+                    else failed++;
+                }
             }
-            cout << "SKU: " << item.sku << ", Name: " << item.name 
-                 << ", Quantity: " << item.quantity << endl;
+            applied += ok;
+            refused += failed;
+        });
+    }
+    for (auto& t : pool) t.join();
+    stop = true;
+    reader.join();
+    
+    StockAggregates totals = hot.aggregates();
+    cout << "Transfers: " << applied << " applied, " << refused << " refused for lack of stock, "
+         << views << " views read" << endl;
+    cout << "Conservation check: " << (totals.unitsOnHand == expected && tornViews == 0 ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Look products up through a memory budget: the same catalog is loaded
+// into an unbounded store and one whose names may only use a tenth of the
+// memory, then both serve Zipfian and uniform key streams. Every name that
+// comes back is checked against the catalog.
+void runPagingBenchmark(size_t productCount, size_t shardCount) {
+    const size_t queryCount = 1000000;
+    
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Memory Budget Paging Benchmark (" << productCount << " products, " << shardCount << " shards)" << endl;
+    cout << string(70, '=') << endl;
+    
+    auto skuOf = [](size_t i) { return "PG" + to_string(i); };
+    auto nameOf = [](size_t i) { return "Catalog item " + to_string(i) + " in the long tail of the assortment"; };
+    size_t nameBytes = 0;
+    for (size_t i = 0; i < productCount; i++) nameBytes += nameOf(i).size();
+    size_t budget = nameBytes / 10;
+    
+    char pagePath[] = "/tmp/inventory-pages-XXXXXX";
+    int pageFd = mkstemp(pagePath);
+    if (pageFd < 0) {
+        cout << "Error: could not create a scratch page file." << endl;
+        return;
+    }
+    close(pageFd);
+    PageFile pages;
+    pages.open(pagePath);
+    
+    ShardedInventory unbounded(shardCount), budgeted(shardCount);
+    budgeted.enablePaging(&pages, budget);
+    for (size_t i = 0; i < productCount; i++) {
+        unbounded.insert(skuOf(i), nameOf(i), 1);
+        budgeted.insert(skuOf(i), nameOf(i), 1);
+    }
+    
+    // Ranks are scattered over the catalog so hot products are not insertion neighbours
+    ZipfianGenerator zipf(productCount);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    vector<size_t> zipfKeys(queryCount), uniformKeys(queryCount);
+    for (size_t q = 0; q < queryCount; q++) {
+        zipfKeys[q] = (zipf.next((next() >> 11) * 0x1.0p-53) * 0x9E3779B97F4A7C15ull) % productCount;
+        uniformKeys[q] = next() % productCount;
+    }
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) skus[i] = skuOf(i);
+    
+    bool correct = true;
+    auto timeLookups = [&](ShardedInventory& store, const vector<size_t>& keys) {
+        Product item;
+        auto start = chrono::high_resolution_clock::now();
+        for (size_t key : keys) {
+            if (!store.find(skus[key], item)) correct = false;
+        }
+        double ns = chrono::duration<double, nano>(chrono::high_resolution_clock::now() - start).count() / keys.size();
+        // Verify outside the timed loop
+        for (size_t q = 0; q < keys.size(); q += 97) {
+            correct = correct && store.find(skus[keys[q]], item) && item.name == nameOf(keys[q]);
         }
+        return ns;
+    };
+    
+    cout << fixed << setprecision(1);
+    cout << setw(12) << left << "Keys" << setw(18) << left << "Unbounded (ns)" << setw(18) << left << "Budget (ns)"
+         << "Hit rate" << endl;
+    cout << string(58, '-') << endl;
+    for (const vector<size_t>* keys : {&zipfKeys, &uniformKeys}) {
+        double full = timeLookups(unbounded, *keys);
+        PagingStats before = budgeted.pagingStats();
+        double paged = timeLookups(budgeted, *keys);
+        PagingStats after = budgeted.pagingStats();
+        uint64_t hits = after.hits - before.hits, misses = after.misses - before.misses;
+        cout << setw(12) << left << (keys == &zipfKeys ? "zipfian" : "uniform") << setw(18) << left << full
+             << setw(18) << left << paged << 100.0 * hits / max<uint64_t>(1, hits + misses) << "%" << endl;
     }
     
-    if (!found) {
-        cout << "Product with name " << name << " not found." << endl;
+    // Delete a third of the catalog under an open view, churn the budget so
+    // the arena is repacked, and check the view still sees every name
+    uint64_t version = budgeted.openView();
+    for (size_t i = 0; i < productCount; i += 3) budgeted.erase(skus[i]);
+    Product item;
+    for (size_t key : uniformKeys) {
+        if (key % 3 != 0) correct = budgeted.find(skus[key], item) && correct;
+    }
+    size_t seen = 0;
+    vector<Product> batch;
+    for (size_t i = 0; i < budgeted.shardCount(); i++) {
+        batch.clear();
+        correct = budgeted.readShardAt(i, version, batch) && correct;
+        for (const Product& row : batch) {
+            correct = correct && row.name == nameOf(stoul(row.sku.substr(2)));
+            seen++;
+        }
     }
+    budgeted.closeView(version);
+    bool viewCorrect = seen == productCount;
+    cout << "Read view across deletes and repacks: " << seen << " of " << productCount << " products" << endl;
+    
+    size_t fullBytes, fullStrings, pagedBytes, pagedStrings;
+    unbounded.storageSizes(fullBytes, fullStrings);
+    budgeted.storageSizes(pagedBytes, pagedStrings);
+    PagingStats p = budgeted.pagingStats();
+    cout << "Resident name bytes: " << nameBytes << " unbounded, " << p.residentBytes << " with a budget of " << budget << endl;
+    cout << "Product storage: " << fullBytes << " bytes unbounded, " << pagedBytes << " bytes with the budget" << endl;
+    cout << "Paged out: " << p.pagedNames << " names, " << p.evictions << " evictions, page file " << p.pageFileBytes << " bytes" << endl;
+    cout << "Lookup results: " << (correct && viewCorrect && p.readErrors == 0 ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
+    pages.close();
+    unlink(pagePath);
 }
 
-// Function to update quantity of existing product
-void updateQuantity() {
-    string sku, quantityStr;
-    int newQuantity;
+// Parse quantity fields the way every entry point used to (a digit scan, then
+// stoi, which throws on overflow) and with parseNumber, for short and
+// full-width quantities, malformed fields and overflowing ones, and check
+// that both accept and produce the same values
+void runParseBenchmark(size_t fieldCount) {
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Number Parsing Benchmark (" << fieldCount << " fields per kind)" << endl;
+    cout << string(70, '=') << endl;
     
-    cout << "Enter SKU to update: ";
-    getline(cin, sku);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    vector<string> shortFields(fieldCount), wideFields(fieldCount), badFields(fieldCount), overflowFields(fieldCount);
+    for (size_t f = 0; f < fieldCount; f++) {
+        shortFields[f] = to_string(next() % 1000);
+        wideFields[f] = to_string(next() % (uint64_t(INT32_MAX) + 1));
+        badFields[f] = to_string(next() % 100000) + "x" + to_string(next() % 10);
+        overflowFields[f] = to_string(uint64_t(INT32_MAX) + 1 + next() % 100000000000ull);
+    }
     
-    for (auto& item : inventory) {
-        if (item.sku == sku) {
-            cout << "Current Quantity: " << item.quantity << endl;
-            cout << "Enter new Quantity: ";
-            getline(cin, quantityStr);
-            
-            if (!isNumeric(quantityStr)) {
-                cout << "Invalid input. Quantity must be a number." << endl;
-                return;
-            }
-            
-            newQuantity = stoi(quantityStr);
-            
-            if (newQuantity < 0) {
-                cout << "Error: Quantity must be positive." << endl;
-                return;
+    auto oldParse = [](const string& text, int& value) {
+        if (text.empty()) return false;
+        for (char c : text) {
+            if (!isdigit(c)) return false;
+        }
+        try {
+            value = stoi(text);
+        } catch (const out_of_range&) {
+            return false;
+        }
+        return true;
+    };
+    auto newParse = [](const string& text, int& value) { return parseNumber(text, value, 0); };
+    
+    // Returns ns per field; sum and accepted let the two parsers be compared
+    auto timeParse = [](const vector<string>& fields, auto parse, uint64_t& sum, size_t& accepted) {
+        sum = 0;
+        accepted = 0;
+        auto start = chrono::high_resolution_clock::now();
+        for (const string& text : fields) {
+            int value;
+            if (parse(text, value)) {
+                sum += value;
+                accepted++;
             }
-            
-            item.quantity = newQuantity;
-            cout << "Quantity updated successfully." << endl;
-            return;
         }
-    }
+        return chrono::duration<double, nano>(chrono::high_resolution_clock::now() - start).count() / fields.size();
+    };
     
-    cout << "Product with SKU " << sku << " not found." << endl;
+    cout << fixed << setprecision(1);
+    cout << setw(22) << left << "Fields" << setw(20) << left << "isNumeric+stoi (ns)" << setw(18) << left << "parseNumber (ns)"
+         << "Accepted" << endl;
+    cout << string(68, '-') << endl;
+    bool correct = true;
+    for (const vector<string>* fields : {&shortFields, &wideFields, &badFields, &overflowFields}) {
+        uint64_t oldSum, newSum;
+        size_t oldAccepted, newAccepted;
+        double oldTime = timeParse(*fields, oldParse, oldSum, oldAccepted);
+        double newTime = timeParse(*fields, newParse, newSum, newAccepted);
+        bool valid = fields == &shortFields || fields == &wideFields;
+        correct = correct && oldSum == newSum && oldAccepted == newAccepted && newAccepted == (valid ? fieldCount : 0);
+        cout << setw(22) << left << (fields == &shortFields ? "0-999" : fields == &wideFields ? "up to INT32_MAX" :
+                                     fields == &badFields ? "malformed" : "overflowing")
+             << setw(20) << left << oldTime << setw(18) << left << newTime << newAccepted << endl;
+    }
+    cout << "Parse results: " << (correct ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
 }
 
-// Function to delete product by SKU
-void deleteProduct() {
-    string sku;
-    cout << "Enter SKU to delete: ";
-    getline(cin, sku);
+// Replicate one store to another in this process over a Unix socket. An
+// empty follower catches up first (the leader's log is kept small, so it
+// takes a snapshot), then writers run on the leader while the follower
+// serves lookups and lag is sampled, and finally the follower is stopped,
+// the leader takes more writes and the follower catches up from the log
+// tail alone. Both copies must end up identical.
+void runReplicationBenchmark(size_t productCount, size_t shardCount) {
+    const double writeSeconds = 2.0;
+    const size_t tailWrites = 10000;
     
-    for (auto it = inventory.begin(); it != inventory.end(); ++it) {
-        if (it->sku == sku) {
-            cout << "Product " << it->name << " removed from inventory." << endl;
-            inventory.erase(it);
-            return;
+    cout << "\n" << string(70, '=') << endl;
+    cout << "Replication Benchmark (" << productCount << " products, " << shardCount << " shards)" << endl;
+    cout << string(70, '=') << endl;
+    
+    char walPath[] = "/tmp/inventory-repl-XXXXXX";
+    int walFd = mkstemp(walPath);
+    if (walFd < 0) {
+        cout << "Error: could not create a scratch journal." << endl;
+        return;
+    }
+    close(walFd);
+    string socketPath = string(walPath) + ".sock";
+    Journal wal;
+    wal.open(walPath, 0, 0, true);
+    ShardedInventory leaderStore(shardCount), followerStore(shardCount);
+    leaderStore.attachJournal(&wal);
+    ReplicationLog log(1 << 20);
+    ReplicationLeader leader(leaderStore, wal, log);
+    if (!leader.start(socketPath)) {
+        cout << "Error: could not listen on " << socketPath << "." << endl;
+        unlink(walPath);
+        return;
+    }
+    
+    vector<string> skus(productCount);
+    for (size_t i = 0; i < productCount; i++) {
+        skus[i] = "RP" + to_string(i);
+        leaderStore.insert(skus[i], "Replicated item " + to_string(i % 1000), 1000);
+    }
+    wal.waitDurable(wal.lastSequence());
+    
+    cout << fixed << setprecision(2);
+    auto start = chrono::high_resolution_clock::now();
+    ReplicaFollower follower(followerStore);
+    follower.start(socketPath, 0);
+    bool correct = follower.waitFor(wal.lastSequence(), 60000);
+    double catchUpMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    ReplicationStats f = follower.stats();
+    cout << "Empty follower: caught up to #" << f.sequence << " in " << catchUpMs << " ms (" << f.snapshots
+         << " snapshot, " << f.bytes << " bytes received)" << endl;
+    
+    // Writers cover every record type: updates, transactions, committed
+    // reservations, inserts and deletes
+    atomic<bool> stop(false);
+    atomic<size_t> writes(0), lookups(0);
+    thread writer([&] {
+        uint64_t x = 0x9E3779B97F4A7C15ull;
+        size_t added = 0, removed = 0;
+        while (!stop.load()) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            const string& sku = skus[x % productCount];
+            int kind = (x >> 40) % 10;
+            if (kind < 6) {
+                leaderStore.update(sku, (int)((x >> 20) % 1000));
+            } else if (kind == 6) {
+                leaderStore.applyTransaction({{sku, 1}, {skus[(x >> 8) % productCount], -1}});
+            } else if (kind == 7) {
+                if (leaderStore.reserve(sku, 1) == OP_OK) leaderStore.commitReserved(sku, 1);
+            } else if (kind == 8 || removed == added) {
+                leaderStore.insert("RPX" + to_string(added++), "Added item", 5);
+            } else {
+                leaderStore.erase("RPX" + to_string(removed++));
+            }
+            writes.fetch_add(1, memory_order_relaxed);
         }
+    });
+    thread reader([&] {
+        Product item;
+        size_t found = 0;
+        for (uint64_t i = 0; !stop.load(); i++) {
+            found += followerStore.find(skus[(i * 2654435761u) % productCount], item);
+            if (i % 1024 == 1023) lookups.fetch_add(1024, memory_order_relaxed);
+        }
+        (void)found;
+    });
+    uint64_t maxBehind = 0;
+    start = chrono::high_resolution_clock::now();
+    double seconds;
+    do {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        maxBehind = max(maxBehind, wal.lastSequence() - min(wal.lastSequence(), follower.stats().sequence));
+        seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    } while (seconds < writeSeconds);
+    stop = true;
+    writer.join();
+    reader.join();
+    wal.waitDurable(wal.lastSequence());
+    correct = follower.waitFor(wal.lastSequence(), 10000) && correct;
+    f = follower.stats();
+    cout << "Under load: " << (size_t)(writes / seconds) << " writes/s on the leader, " << (size_t)(lookups / seconds)
+         << " lookups/s on the follower" << endl;
+    cout << "Lag, durable on the leader to applied: average " << f.averageLagMs << " ms, max " << f.maxLagMs
+         << " ms; at most " << maxBehind << " records behind" << endl;
+    
+    // One write at a time: how soon each is readable on the follower
+    vector<double> visibleMs;
+    for (size_t i = 0; i < 200; i++) {
+        auto written = chrono::high_resolution_clock::now();
+        leaderStore.update(skus[i % productCount], (int)i);
+        if (!follower.waitFor(wal.lastSequence(), 10000)) correct = false;
+        visibleMs.push_back(chrono::duration<double, milli>(chrono::high_resolution_clock::now() - written).count());
     }
+    sort(visibleMs.begin(), visibleMs.end());
+    cout << "Single writes, written on the leader to readable on the follower: p50 " << visibleMs[visibleMs.size() / 2]
+         << " ms, p99 " << visibleMs[visibleMs.size() * 99 / 100] << " ms" << endl;
     
-    cout << "Product with SKU " << sku << " not found." << endl;
+    follower.stop();
+    uint64_t stoppedAt = follower.stats().sequence, snapshotsBefore = follower.stats().snapshots;
+    for (size_t i = 0; i < tailWrites; i++) leaderStore.update(skus[i % productCount], (int)(i % 500));
+    wal.waitDurable(wal.lastSequence());
+    start = chrono::high_resolution_clock::now();
+    follower.start(socketPath, stoppedAt);
+    correct = follower.waitFor(wal.lastSequence(), 10000) && correct;
+    double tailMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    bool fromTail = follower.stats().snapshots == snapshotsBefore;
+    cout << "Restarted follower: " << wal.lastSequence() - stoppedAt << " records from the log tail in " << tailMs
+         << " ms (" << (fromTail ? "no snapshot needed" : "needed a snapshot") << ")" << endl;
+    follower.stop();
+    leader.stop();
+    
+    auto contents = [](ShardedInventory& store) {
+        vector<tuple<string, string, int>> rows;
+        store.forEach([&](const ProductTable& products, size_t i) {
+            string name;
+            products.name(i, name);
+            rows.emplace_back(string(products.sku(i)), name, products.stock(i).onHand());
+        });
+        sort(rows.begin(), rows.end());
+        return rows;
+    };
+    bool identical = contents(leaderStore) == contents(followerStore);
+    cout << "Replica contents: " << (correct && fromTail && identical ? "✓ PASSED" : "✗ FAILED") << endl;
+    cout.unsetf(ios::fixed);
+    leaderStore.attachJournal(nullptr);
+    wal.close();
+    unlink(walPath);
 }
 
 // Program entry point
-int main() {
+int main(int argc, char* argv[]) {
     int choice;
     
+    int syncWindowMicros = 0;
+    bool asyncCommit = false;
+    string importPath;
+    bool batchMode = false;
+    size_t shardCount = DEFAULT_SHARDS;
+    size_t benchProducts = 0;
+    size_t reserveThreads = 0;
+    size_t fuzzyProducts = 0;
+    size_t viewProducts = 0;
+    size_t exportProducts = 0;
+    string serveAddress, loadAddress;
+    size_t loadConnections = 4, loadDepth = 32;
+    size_t workloadProducts = 0, workloadOps = 1000000;
+    vector<WorkloadMix> workloadMixes = {{"A", {50, 50, 0, 0}}, {"B", {95, 5, 0, 0}}, {"C", {100, 0, 0, 0}},
+                                         {"D", {95, 0, 5, 0}}, {"W", {60, 20, 10, 10}}};
+    string workloadKeys = "both";
+    size_t feedOperations = 0;
+    uint32_t metricsSample = 0;
+    size_t bloomProducts = 0;
+    size_t transactionProducts = 0;
+    size_t pagingProducts = 0;
+    size_t parseFields = 0;
+    size_t replicationProducts = 0;
+    string leaderAddress, followAddress;
+    size_t memoryBudgetMB = 0;
+    string pagePath = "inventory.pages";
+    string exportPath;
+    ReportFormat exportFormat = REPORT_CSV;
+    size_t exportOffset = 0, exportLimit = SIZE_MAX;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        // Consume the next argument into value if it is a number in [low, high]
+        auto numberArg = [&](auto& value, long long low = 0, unsigned long long high = numeric_limits<unsigned long long>::max()) {
+            using T = remove_reference_t<decltype(value)>;
+            T top = T(min<unsigned long long>(high, numeric_limits<T>::max()));
+            if (i + 1 >= argc || !parseNumber(string_view(argv[i + 1]), value, T(low), top)) return false;
+            i++;
+            return true;
+        };
+        if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (arg == "--journal" && i + 1 < argc) {
+            journalPath = argv[++i];
+        } else if (arg == "--sync-window-ms" && numberArg(syncWindowMicros, 0, INT32_MAX / 1000)) {
+            syncWindowMicros *= 1000;
+        } else if (arg == "--async-commit") {
+            asyncCommit = true;
+        } else if (arg == "--import" && i + 1 < argc) {
+            importPath = argv[++i];
+        } else if (arg == "--batch") {
+            batchMode = true;
+        } else if (arg == "--shards" && numberArg(shardCount, 1, INT32_MAX)) {
+        } else if (arg == "--bench-threads") {
+            benchProducts = 1000000;
+            numberArg(benchProducts);
+        } else if (arg == "--bench-reserve") {
+            reserveThreads = 8;
+            if (numberArg(reserveThreads, 0, INT32_MAX)) reserveThreads = max<size_t>(1, reserveThreads);
+        } else if (arg == "--bench-fuzzy") {
+            fuzzyProducts = 1000000;
+            numberArg(fuzzyProducts);
+        } else if (arg == "--bench-views") {
+            viewProducts = 200000;
+            numberArg(viewProducts);
+        } else if (arg == "--bench-export") {
+            exportProducts = 200000;
+            if (numberArg(exportProducts)) exportProducts = max<size_t>(1, exportProducts);
+        } else if (arg == "--bench-ycsb") {
+            workloadProducts = 1000000;
+            if (numberArg(workloadProducts)) workloadProducts = max<size_t>(1, workloadProducts);
+            numberArg(workloadOps);
+        } else if (arg == "--mix" && i + 1 < argc) {
+            // read/update/insert/delete percentages, e.g. 80/10/5/5
+            WorkloadMix mix{"custom", {0, 0, 0, 0}};
+            string text = argv[++i];
+            int sum = 0;
+            size_t at = 0;
+            for (int kind = 0; kind < WORK_OP_COUNT; kind++) {
+                size_t slash = text.find('/', at);
+                string part = at > text.size() ? "" : text.substr(at, slash == string::npos ? string::npos : slash - at);
+                if (!parseNumber(part, mix.percent[kind], 0, 100)) {
+                    sum = -1;
+                    break;
+                }
+                sum += mix.percent[kind];
+                at = slash == string::npos ? text.size() + 1 : slash + 1;
+            }
+            if (sum != 100 || at <= text.size()) {
+                cout << "Error: --mix needs four read/update/insert/delete percentages summing to 100." << endl;
+                return 1;
+            }
+            workloadMixes = {mix};
+        } else if (arg == "--keys" && i + 1 < argc && (string(argv[i + 1]) == "zipfian" || string(argv[i + 1]) == "uniform")) {
+            workloadKeys = argv[++i];
+        } else if (arg == "--metrics-sample" && numberArg(metricsSample, 0, 999999999)) {
+            metricsSample = max<uint32_t>(1, metricsSample);
+        } else if (arg == "--bench-bloom") {
+            bloomProducts = 1000000;
+            if (numberArg(bloomProducts)) bloomProducts = max<size_t>(1, bloomProducts);
+        } else if (arg == "--bench-txn") {
+            transactionProducts = 100000;
+            if (numberArg(transactionProducts)) transactionProducts = max<size_t>(1, transactionProducts);
+        } else if (arg == "--bench-paging") {
+            pagingProducts = 200000;
+            if (numberArg(pagingProducts)) pagingProducts = max<size_t>(1, pagingProducts);
+        } else if (arg == "--bench-parse") {
+            parseFields = 5000000;
+            if (numberArg(parseFields)) parseFields = max<size_t>(1, parseFields);
+        } else if (arg == "--bench-replication") {
+            replicationProducts = 200000;
+            if (numberArg(replicationProducts)) replicationProducts = max<size_t>(1, replicationProducts);
+        } else if (arg == "--leader" && i + 1 < argc) {
+            leaderAddress = argv[++i];
+        } else if (arg == "--follow" && i + 1 < argc) {
+            followAddress = argv[++i];
+        } else if (arg == "--memory-budget" && numberArg(memoryBudgetMB, 0, 999999999)) {
+            memoryBudgetMB = max<size_t>(1, memoryBudgetMB);
+        } else if (arg == "--page-file" && i + 1 < argc) {
+            pagePath = argv[++i];
+        } else if (arg == "--feed-demo") {
+            feedOperations = 1000000;
+            numberArg(feedOperations);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serveAddress = argv[++i];
+        } else if (arg == "--export" && i + 1 < argc) {
+            exportPath = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc && (string(argv[i + 1]) == "table" ||
+                   string(argv[i + 1]) == "csv" || string(argv[i + 1]) == "binary")) {
+            string name = argv[++i];
+            exportFormat = name == "table" ? REPORT_TABLE : name == "csv" ? REPORT_CSV : REPORT_BINARY;
+        } else if (arg == "--offset" && numberArg(exportOffset)) {
+        } else if (arg == "--limit" && numberArg(exportLimit)) {
+        } else if (arg == "--loadgen" && i + 1 < argc) {
+            loadAddress = argv[++i];
+            if (numberArg(loadConnections, 0, INT32_MAX)) loadConnections = max<size_t>(1, loadConnections);
+            if (numberArg(loadDepth, 0, INT32_MAX)) loadDepth = max<size_t>(1, loadDepth);
+        } else {
+            cout << "Usage: " << argv[0] << " [--snapshot <path>] [--journal <path>]"
+                 << " [--sync-window-ms <ms>] [--async-commit] [--import <file.csv|file.tsv>] [--batch]"
+                 << " [--shards <n>] [--bench-threads [products]] [--bench-reserve [threads]]"
+                 << " [--bench-fuzzy [products]] [--bench-views [products]] [--bench-export [products]]"
+                 << " [--bench-ycsb [products [operations]] [--mix r/u/i/d] [--keys zipfian|uniform]]"
+                 << " [--bench-bloom [products]] [--bench-txn [products]] [--bench-paging [products]] [--bench-parse [fields]] [--bench-replication [products]] [--feed-demo [operations]] [--metrics-sample <n>] [--serve <socket path | port>]"
+                 << " [--loadgen <socket path | port> [connections [pipeline depth]]]"
+                 << " [--leader <socket path | port> | --follow <socket path | port>]"
+                 << " [--memory-budget <MB> [--page-file <path>]]"
+                 << " [--export <file | -> [--format table|csv|binary] [--offset n] [--limit n]]" << endl;
+            return 1;
+        }
+    }
+    
+    if (benchProducts > 0) {
+        runThreadBenchmark(benchProducts, shardCount);
+        return 0;
+    }
+    if (reserveThreads > 0) {
+        runReservationBenchmark(reserveThreads);
+        return 0;
+    }
+    if (fuzzyProducts > 0) {
+        runFuzzyBenchmark(fuzzyProducts, shardCount);
+        return 0;
+    }
+    if (viewProducts > 0) {
+        runSnapshotBenchmark(viewProducts);
+        return 0;
+    }
+    if (exportProducts > 0) {
+        runExportBenchmark(exportProducts);
+        return 0;
+    }
+    if (bloomProducts > 0) {
+        runBloomBenchmark(bloomProducts, shardCount);
+        return 0;
+    }
+    if (pagingProducts > 0) {
+        runPagingBenchmark(pagingProducts, shardCount);
+        return 0;
+    }
+    if (parseFields > 0) {
+        runParseBenchmark(parseFields);
+        return 0;
+    }
+    if (replicationProducts > 0) {
+        runReplicationBenchmark(replicationProducts, shardCount);
+        return 0;
+    }
+    if (transactionProducts > 0) {
+        runTransactionBenchmark(transactionProducts, shardCount);
+        return 0;
+    }
+    if (feedOperations > 0) {
+        runFeedDemo(feedOperations);
+        return 0;
+    }
+    if (workloadProducts > 0) {
+        runWorkloadBenchmark(workloadProducts, workloadOps, shardCount, workloadMixes, workloadKeys);
+        return 0;
+    }
+    if (!loadAddress.empty()) {
+        runLoadGenerator(loadAddress, loadConnections, 1000000 / loadConnections, loadDepth);
+        return 0;
+    }
+    if (!followAddress.empty() && (!leaderAddress.empty() || !importPath.empty())) {
+        cout << "Error: a replica (--follow) only changes through its leader; it cannot also lead or import." << endl;
+        return 1;
+    }
+    inventory.configure(shardCount);
+    
+    // In batch and stdout-export mode stdout carries only data; status messages go to stderr
+    if (batchMode || exportPath == "-") cout.rdbuf(cerr.rdbuf());
+    
+    if (memoryBudgetMB > 0) {
+        if (!namePages.open(pagePath)) {
+            cout << "Error: could not open page file " << pagePath << "." << endl;
+            return 1;
+        }
+        inventory.enablePaging(&namePages, memoryBudgetMB << 20);
+    }
+    
+    auto loadStart = chrono::high_resolution_clock::now();
+    uint64_t lastSequence = 0;
+    SnapshotLoadResult loaded = loadSnapshot(snapshotPath, lastSequence);
+    if (loaded == SNAPSHOT_INVALID) {
+        cout << "Error: " << snapshotPath << " is not a valid inventory snapshot." << endl;
+        return 1;
+    }
+    size_t replayed = replayJournal(journalPath, lastSequence, lastSequence);
+    if (loaded == SNAPSHOT_LOADED || replayed > 0) {
+        auto loadEnd = chrono::high_resolution_clock::now();
+        cout << "Loaded " << inventory.size() << " products (" << replayed << " journal records replayed) in "
+             << fixed << setprecision(3) << chrono::duration<double, milli>(loadEnd - loadStart).count() << " ms" << endl;
+        cout.unsetf(ios::fixed);
+    }
+    
+    if (!journal.open(journalPath, lastSequence, syncWindowMicros, asyncCommit)) {
+        cout << "Error: Could not open journal " << journalPath << "." << endl;
+        return 1;
+    }
+    // A replica journals the records its leader sends instead
+    if (followAddress.empty()) inventory.attachJournal(&journal);
+    inventory.attachFeed(&changeFeed);
+    inventory.attachMetrics(&metrics);
+    // Time one operation in 16 by default; at menu speed every one is timed
+    metrics.setSampleInterval(metricsSample ? metricsSample : batchMode || !serveAddress.empty() ? 16 : 1);
+    
+    if (!importPath.empty()) {
+        ImportReport report;
+        if (!importFile(importPath, report)) {
+            cout << "Error: Could not read import file " << importPath << "." << endl;
+            return 1;
+        }
+        cout << "Imported " << report.imported << " products from " << importPath << " ("
+             << report.duplicates << " duplicate SKUs skipped, " << report.rejected << " invalid lines";
+        if (report.firstBadLine != 0) cout << ", first at line " << report.firstBadLine;
+        cout << ")" << endl;
+        cout << "Parse: " << fixed << setprecision(3) << report.parseMs << " ms, Load: " << report.loadMs << " ms" << endl;
+        cout.unsetf(ios::fixed);
+        
+        // Persist the import as a snapshot rather than journaling every row.
+        // Skipping a sequence number makes followers resynchronize from a
+        // snapshot, since the imported rows never reach the replication log.
+        // Without that snapshot the rows would be lost on restart, so stop.
+        if (report.imported > 0) {
+            journal.restartAt(journal.lastSequence() + 1);
+            if (!saveInventory()) {
+                cout << "Error: Imported products could not be persisted." << endl;
+                return 1;
+            }
+        }
+    }
+    
+    if (!exportPath.empty()) {
+        int fd = STDOUT_FILENO;
+        if (exportPath != "-") fd = open(exportPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cout << "Error: Could not open " << exportPath << "." << endl;
+            return 1;
+        }
+        ReportStats stats = writeReport(fd, exportFormat, exportOffset, exportLimit);
+        if (fd != STDOUT_FILENO && close(fd) != 0) stats.ok = false;
+        if (!stats.ok) {
+            cout << "Error: Export to " << exportPath << " was not fully written (a write failed, or a SKU or name is too long"
+                 << " for the binary format)." << endl;
+            return 1;
+        }
+        cout << "Exported " << stats.rows << " products (" << stats.bytes << " bytes) in " << fixed
+             << setprecision(3) << stats.ms << " ms";
+        if (stats.ms > 0) cout << " (" << stats.bytes / stats.ms / 1000 << " MB/s)";
+        cout << endl;
+        return 0;
+    }
+    if (!leaderAddress.empty()) {
+        if (!replicationLeader.start(leaderAddress)) {
+            cout << "Error: Could not listen for followers on " << leaderAddress << "." << endl;
+            return 1;
+        }
+        cout << "Leading replication on " << (isTcpAddress(leaderAddress) ? "127.0.0.1:" : "") << leaderAddress
+             << " from #" << journal.lastSequence() << endl;
+    }
+    if (!followAddress.empty()) {
+        replica.start(followAddress, lastSequence);
+        cout << "Following " << followAddress << " from #" << lastSequence << " (read-only)" << endl;
+    }
+    if (batchMode) {
+        runBatch(STDIN_FILENO, STDOUT_FILENO);
+        saveInventory();
+        return 0;
+    }
+    if (!serveAddress.empty()) {
+        if (!runServer(serveAddress)) return 1;
+        saveInventory();
+        return 0;
+    }
+    
     while (true) {
         cout << "\n========== Inventory Stock Manager ==========" << endl;
         cout << "1. Insert New Product" << endl;
@@ -202,23 +7239,32 @@ int main() {
         cout << "4. Search Product by Name" << endl;
         cout << "5. Update Product Quantity" << endl;
         cout << "6. Delete Product" << endl;
-        cout << "7. Exit" << endl;
+        cout << "7. Index Statistics" << endl;
+        cout << "8. Reserve / Commit / Release Stock" << endl;
+        cout << "9. Save Snapshot" << endl;
+        cout << "10. Compact Storage" << endl;
+        cout << "11. Stock Level Report" << endl;
+        cout << "12. Export Inventory" << endl;
+        cout << "13. Operation Metrics" << endl;
+        cout << "14. Exit" << endl;
         cout << "============================================" << endl;
-        cout << "Enter your choice (1-7): ";
+        cout << "Enter your choice (1-14): ";
         
         string input;
-        getline(cin, input);
+        if (!getline(cin, input)) {
+            // End of input: behave like Exit
+            saveInventory();
+            return 0;
+        }
         
-        if (!isNumeric(input)) {
-            cout << "Invalid choice. Please select from 1 to 7." << endl;
+        if (!parseNumber(input, choice)) {
+            cout << "Invalid choice. Please select from 1 to 14." << endl;
             continue;
         }
         
-        choice = stoi(input);
-        
         switch (choice) {
             case 1:
-                insertProduct();
+                if (writable()) insertProduct();
                 break;
             case 2:
                 displayInventory();
@@ -230,18 +7276,41 @@ int main() {
                 searchByName();
                 break;
             case 5:
-                updateQuantity();
+                if (writable()) updateQuantity();
                 break;
             case 6:
-                deleteProduct();
+                if (writable()) deleteProduct();
                 break;
             case 7:
-                cout << "Exiting Inventory Manager." << endl;
+                displayIndexStats();
+                break;
+            case 8:
+                if (writable()) manageReservation();
                 break;
+            case 9:
+                saveInventory();
+                break;
+            case 10:
+                compactStorage();
+                break;
+            case 11:
+                stockReport();
+                break;
+            case 12:
+                exportInventory();
+                break;
+            case 13:
+                displayMetrics();
+                break;
+            case 14:
+                saveInventory();
+                cout << "Exiting Inventory Manager." << endl;
+                return 0;
             default:
-                cout << "Invalid choice. Please select from 1 to 7." << endl;
+                cout << "Invalid choice. Please select from 1 to 14." << endl;
         }
     }
     
     return 0;
-}7
\ No newline at end of file
+}
+